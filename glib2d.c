@@ -23,8 +23,11 @@
 #include <pspdisplay.h>
 #include <pspgu.h>
 #include <vram.h>
+#include <limits.h>
 #include <malloc.h>
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
 
 #ifdef USE_PNG
 #include <png.h>
@@ -34,17 +37,51 @@
 #include <jpeglib.h>
 #endif
 
+#if !defined(USE_VFPU) && defined(__SSE2__)
+#include <emmintrin.h>
+#elif !defined(USE_VFPU) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 /* Defines */
 
+#ifndef DLIST_SIZE
 #define DLIST_SIZE              (524288)
+#endif
+#define DLIST_NBR               (2)
+#define DLIST_MARGIN            (1024)
+#define BATCH_SIZE              (16384)
 #define LINE_SIZE               (512)
 #define PIXEL_SIZE              (4)
 #define FRAMEBUFFER_SIZE        (LINE_SIZE*G2D_SCR_H*PIXEL_SIZE)
+#define DEPTHBUFFER_SIZE        (LINE_SIZE*G2D_SCR_H*2)
+#define VRAM_SIZE               (2*1024*1024)
+#define VRAM_POOL_START         (FRAMEBUFFER_SIZE*2+DEPTHBUFFER_SIZE)
+#define VRAM_PROMOTE_FRAMES     (2)
 #define MALLOC_STEP             (128)
-#define TSTACK_MAX              (64)
-#define SLICE_WIDTH             (64.f)
+#define OBJ_STORE_SIZE          (1024)
+#define INDEX_QUAD_NBR          (4096)
+#define TSTACK_SIZE             (64)
+#define MAT_RUN_SIZE            (64)
+#define SLICE_BYTES             (256)
+#define SLICE_BYTES_SWIZZLED    (512)
+#define TEX_CACHE_SIZE          (8192)
+#define ATLAS_PAGE_SIZE         (512)
+#define ATLAS_PADDING           (1)
 #define M_180_PI                (57.29578f)
 #define M_PI_180                (0.017453292f)
+#define INLINE                  inline __attribute__((always_inline))
+
+#if defined(USE_VFPU) || defined(__SSE2__) || defined(__ARM_NEON)
+#define SIMD_CORNERS
+#endif
+
+#define V_TEX                   (1)
+#define V_COLOR                 (2)
+#define V_ROT                   (4)
+#define V_INT                   (8)
+#define V_SHORT                 (16)
+#define V_FLAGS_NBR             (32)
 
 #define DEFAULT_SIZE            (10)
 #define DEFAULT_COORD_MODE      (G2D_UP_LEFT)
@@ -54,30 +91,48 @@
 #define DEFAULT_COLOR           (WHITE)
 #define DEFAULT_ALPHA           (0xFF)
 
-#define OBJ                     rctx.obj[rctx.n-1]
-#define OBJ_I                   rctx.obj[i]
 #define TRANSFORM               tstack[tstack_size-1]
+#define MAT_AXIS_ALIGNED(m)     ((m).b == 0.f && (m).c == 0.f && \
+                                 (m).a > 0.f && (m).d > 0.f)
+
+#ifdef USE_STATS
+#define STATS_ADD(field, n)     (cur_stats.field += (n))
+#else
+#define STATS_ADD(field, n)
+#endif
 
 /* Enumerations */
 
 typedef enum
 {
-    RECTS, LINES, QUADS, POINTS
+    RECTS, LINES, QUADS, POINTS, MESH
 } Obj_Type;
 
 /* Structures */
 
+typedef struct
+{
+    float a, b, x;          // x' = a*x + b*y + x
+    float c, d, y;          // y' = c*x + d*y + y
+} Matrix;
+
+typedef struct
+{
+    unsigned int first;     // First object transformed by this matrix.
+    Matrix m;
+} MatRun;
+
 typedef struct
 {
     float x, y, z;
     float rot, rot_sin, rot_cos;
     float scale_w, scale_h;
+    Matrix mat;
 } Transform;
 
 typedef struct
 {
     float x, y, z;
-    float rot_x, rot_y; // Rotation center
     float rot, rot_sin, rot_cos;
     int crop_x, crop_y;
     int crop_w, crop_h;
@@ -88,11 +143,29 @@ typedef struct
 
 typedef struct
 {
-    Object *obj;
+    // Hot arrays, used by every batch.
+    float *x, *y, *z;
+    float *w, *h;
+    g2dColor *color;
+    // Cold arrays, only written by rotated or textured batches.
+    float *m00, *m01;       // Linear part, x & y being the up left corner.
+    float *m10, *m11;
+    int *crop_x, *crop_y;
+    int *crop_w, *crop_h;
+    void *data;             // All the arrays, in one block.
+    unsigned int n;         // Objects stored.
+    unsigned int size;      // Capacity, never shrunk.
+} ObjStore;
+
+typedef struct
+{
     Object cur_obj;
+    unsigned int first;     // First object in the store.
     unsigned int n;
+    unsigned int rot_n;     // Objects with a rotation, from the first one.
     Obj_Type type;
     g2dTexture *tex;
+    int mesh_cols, mesh_rows;
 
     bool use_strip;
     bool use_z;
@@ -101,26 +174,178 @@ typedef struct
     bool use_tex_linear;
     bool use_tex_repeat;
     bool use_int;
+    bool use_compact;
+    int slice_w;            // Texels per slice, see _g2dSliceWidth().
     unsigned int color_count;
     g2dCoord_Mode coord_mode;
 } RenderContext;
 
+typedef struct
+{
+    bool valid;
+    bool tex_valid;
+    bool depth_test;
+    bool texture_2d;
+    bool tex_linear;
+    bool tex_repeat;
+    g2dColor color;
+    g2dTexture *tex;
+    g2dColor *tex_data;
+    bool tex_swizzled;
+    g2dColor *clut;
+} GuState;
+
+typedef struct
+{
+    g2dTexture *tex;
+    g2dColor *src;          // Texture data when uploaded.
+    g2dColor *data;         // Copy in the pool, NULL if not resident.
+    unsigned int offset;    // Relative to the VRAM start.
+    unsigned int size;
+    unsigned int last_frame;
+    unsigned int frames;    // Consecutive frames the texture was drawn in.
+} VramEntry;
+
+typedef void* (*Emitter)(void *vp, unsigned int i, unsigned int n);
+
+typedef struct
+{
+    int *data;
+    unsigned int size;
+} DlistSegment;
+
+typedef struct
+{
+    DlistSegment *seg;
+    unsigned int seg_nbr;   // Allocated segments.
+    unsigned int n;         // Segments used by the frame.
+} Dlist;
+
+typedef struct
+{
+    g2dTexture *tex;
+    g2dColor color;
+    bool use_z;
+    bool use_vert_color;
+    bool use_tex_linear;
+    bool use_tex_repeat;
+    int prim, type, nbr, size;
+    const void *idx;
+    int v_nbr;
+    void *v;
+} BatchDraw;
+
+typedef struct
+{
+    int x, y, w;            // Top of the packed area, from x to x+w.
+} SkylineNode;
+
+typedef struct
+{
+    g2dTexture *tex;
+    SkylineNode sky[ATLAS_PAGE_SIZE+1]; // One more while inserting.
+    int sky_n;
+} AtlasPage;
+
+struct g2dAtlas
+{
+    AtlasPage **pages;
+    unsigned int page_n;
+    g2dAtlasImage **images;
+    unsigned int image_n;
+    bool swizzled;
+};
+
+typedef struct
+{
+    g2dColor color;
+    unsigned int count;     // Texels of this color.
+    unsigned int index;     // Palette entry.
+} QuantColor;
+
+typedef struct
+{
+    unsigned int first, n;  // Colors in the box.
+    int shift, range;       // Widest channel.
+} QuantBox;
+
+struct g2dBatch
+{
+    Dlist list;
+    BatchDraw *draw;
+    unsigned int n;
+    unsigned int v_nbr;
+    GuState state;          // State of the GE once the batch is called.
+    bool use_z;
+};
+
 /* Local variables */
 
-static int *dlist;
+static Dlist dlists[DLIST_NBR];
+static Dlist *dlist;
+static unsigned int dlist_i;
+static unsigned int dlist_bytes;
+static unsigned int dlist_peak;
 
+static g2dBatch *batch;     // Batch being recorded.
+static Dlist *batch_parent;
+static GuState batch_parent_state;
+
+static ObjStore objs;
+static void **obj_fields[] =
+{
+    (void**)&objs.x, (void**)&objs.y, (void**)&objs.z,
+    (void**)&objs.w, (void**)&objs.h, (void**)&objs.color,
+    (void**)&objs.m00, (void**)&objs.m01,
+    (void**)&objs.m10, (void**)&objs.m11,
+    (void**)&objs.crop_x, (void**)&objs.crop_y,
+    (void**)&objs.crop_w, (void**)&objs.crop_h
+};
+static unsigned short quad_idx[6*INDEX_QUAD_NBR] __attribute__((aligned(16)));
+static float *corners;
+static unsigned int corners_size;
 static RenderContext rctx;
+static RenderContext pending;
+static GuState gu_state;
+
+static VramEntry *vram_ents;
+static unsigned int vram_n;
+static unsigned int vram_size;
+static unsigned int vram_frame;
+static unsigned int vram_bytes; // Resident in the pool.
+static bool vram_pool = false;
 
-static Transform tstack[TSTACK_MAX];
+static Transform *tstack;
 static unsigned int tstack_size;
+static unsigned int tstack_cap;
+
+static Matrix mat;
+static bool mat_dirty;      // Changed since the last run.
+static MatRun *mat_runs;
+static unsigned int mat_run_n;
+static unsigned int mat_run_size;
 
 static bool init = false;
 static bool start = false;
 static bool begin = false;
 static bool zclear = true;
 static bool scissor = false;
+static bool deferred = false;
+static bool async = false;
+static bool frame_async = false;
+static bool in_flight = false;
 
 static float global_scale;
+static float clip[4];       // Scissor, x0 y0 x1 y1.
+static int slice_force;     // Slice width used by all textures, if not 0.
+static bool use_cull = true; // Objects out of the scissor are dropped.
+static bool use_clip = true; // Slices out of the scissor are cut.
+static int quant_shift;     // Channel compared by _g2dQuantCompareChannel().
+
+#ifdef USE_STATS
+static g2dFrameStats cur_stats;
+static g2dFrameStats last_stats;
+#endif
 
 /* Global variables */
 
@@ -130,7 +355,9 @@ g2dTexture g2d_draw_buffer =
     G2D_SCR_W, G2D_SCR_H, 
     (float)G2D_SCR_W/G2D_SCR_H,
     false, 
-    (g2dColor*)FRAMEBUFFER_SIZE
+    (g2dColor*)FRAMEBUFFER_SIZE,
+    GU_PSM_8888,
+    NULL
 };
 
 g2dTexture g2d_disp_buffer =
@@ -139,551 +366,554 @@ g2dTexture g2d_disp_buffer =
     G2D_SCR_W, G2D_SCR_H, 
     (float)G2D_SCR_W/G2D_SCR_H,
     false, 
-    (g2dColor*)0
+    (g2dColor*)0,
+    GU_PSM_8888,
+    NULL
 };
 
 /* Internal functions */
 
-void _g2dStart()
+void _g2dFlush();
+
+
+int _g2dTexBits(int psm)
 {
-    if (!init)
-        g2dInit();
+    // 5650, 5551, 4444, 8888, T4, T8, T16, T32, DXT1, DXT3, DXT5
+    static const int bits[] = {16, 16, 16, 32, 4, 8, 16, 32, 4, 8, 8};
 
-    sceKernelDcacheWritebackRange(dlist, DLIST_SIZE);
-    sceGuStart(GU_DIRECT, dlist);
-    start = true;
+    return bits[psm];
 }
 
 
-void* _g2dSetVertex(void *vp, int i, float vx, float vy)
+unsigned int _g2dTexSize(const g2dTexture *tex)
 {
-    // Vertex order: [texture uv] [color] [coord]
-    short *vp_short;
-    g2dColor *vp_color;
-    float *vp_float;
+    return tex->tw * tex->th * _g2dTexBits(tex->psm) / 8;
+}
 
-    // Texture coordinates
-    vp_short = (short*)vp;
-    
-    if (rctx.tex != NULL)
-    {
-        *(vp_short++) = OBJ_I.crop_x + vx * OBJ_I.crop_w;
-        *(vp_short++) = OBJ_I.crop_y + vy * OBJ_I.crop_h;
-    }
 
-    // Color
-    vp_color = (g2dColor*)vp_short;
+DlistSegment* _g2dGetSegment(Dlist *list, unsigned int size)
+{
+    DlistSegment *seg;
+    void *data;
 
-    if (rctx.use_vert_color)
+    // The list is left as it is on failure.
+    if (list->n == list->seg_nbr)
     {
-        *(vp_color++) = OBJ_I.color;
+        seg = realloc(list->seg, (list->seg_nbr+1) * sizeof(DlistSegment));
+        if (seg == NULL)
+            return NULL;
+
+        list->seg = seg;
+        list->seg[list->seg_nbr].data = NULL;
+        list->seg[list->seg_nbr].size = 0;
+        list->seg_nbr++;
     }
 
-    // Coordinates
-    vp_float = (float*)vp_color;
-
-    vp_float[0] = OBJ_I.x;
-    vp_float[1] = OBJ_I.y;
+    seg = &list->seg[list->n];
 
-    if (rctx.type == RECTS)
+    // Segments are kept from a frame to another, and only grown.
+    if (seg->size < size)
     {
-        vp_float[0] += vx * OBJ_I.scale_w;
-        vp_float[1] += vy * OBJ_I.scale_h;
-        
-        if (rctx.use_rot) // Apply a rotation
-        {
-            float tx = vp_float[0] - OBJ_I.rot_x;
-            float ty = vp_float[1] - OBJ_I.rot_y;
-
-            vp_float[0] = OBJ_I.rot_x - OBJ_I.rot_sin*ty + OBJ_I.rot_cos*tx, 
-            vp_float[1] = OBJ_I.rot_y + OBJ_I.rot_cos*ty + OBJ_I.rot_sin*tx;
-        }
-    }
+        if ((data = malloc(size)) == NULL)
+            return NULL;
 
-    if (rctx.use_int) // Pixel perfect
-    {
-        vp_float[0] = floorf(vp_float[0]);
-        vp_float[1] = floorf(vp_float[1]);
+        free(seg->data);
+        seg->data = data;
+        seg->size = size;
     }
-    vp_float[2] = OBJ_I.z;
-
-    return (void*)(vp_float + 3);
-}
-
 
-#ifdef USE_VFPU
-void vfpu_sincosf(float x, float *s, float *c)
-{
-    __asm__ volatile (
-        "mtv    %2, s000\n"           // s000 = x
-        "vcst.s s001, VFPU_2_PI\n"    // s001 = 2/pi
-        "vmul.s s000, s000, s001\n"   // s000 = s000*s001
-        "vrot.p c010, s000, [s, c]\n" // s010 = sinf(s000), s011 = cosf(s000)
-        "mfv    %0, s010\n"           // *s = s010
-        "mfv    %1, S011\n"           // *c = s011
-        : "=r"(*s), "=r"(*c) : "r"(x)
-    );
+    return seg;
 }
-#endif
 
-/* Main functions */
 
-void g2dInit()
+bool _g2dStartSegment(unsigned int size)
 {
-    if (init)
-        return;
-
-    // Display list allocation
-    dlist = malloc(DLIST_SIZE);
-
-    // Setup GU
-    sceGuInit();
-    sceGuStart(GU_DIRECT, dlist);
-
-    sceGuDrawBuffer(GU_PSM_8888, g2d_draw_buffer.data, LINE_SIZE);
-    sceGuDispBuffer(G2D_SCR_W, G2D_SCR_H, g2d_disp_buffer.data, LINE_SIZE);
-    sceGuDepthBuffer((void*)(FRAMEBUFFER_SIZE*2), LINE_SIZE);
-    sceGuOffset(2048-G2D_SCR_W/2, 2048-G2D_SCR_H/2);
-    sceGuViewport(2048, 2048, G2D_SCR_W, G2D_SCR_H);
-    
-    g2d_draw_buffer.data = vabsptr(g2d_draw_buffer.data);
-    g2d_disp_buffer.data = vabsptr(g2d_disp_buffer.data);
+    DlistSegment *seg = _g2dGetSegment(dlist, size);
 
-    sceGuDepthRange(65535, 0);
-    sceGuClearDepth(65535);
-    sceGuAlphaFunc(GU_GREATER, 0, 255);
-    sceGuDepthFunc(GU_LEQUAL);
-    sceGuBlendFunc(GU_ADD, GU_SRC_ALPHA, GU_ONE_MINUS_SRC_ALPHA, 0, 0);
-    sceGuTexFunc(GU_TFX_MODULATE, GU_TCC_RGBA);
-    sceGuTexFilter(GU_LINEAR, GU_LINEAR);
-    sceGuShadeModel(GU_SMOOTH);
+    if (seg == NULL)
+        return false;
 
-    sceGuDisable(GU_CULL_FACE);
-    sceGuDisable(GU_CLIP_PLANES);
-    sceGuDisable(GU_DITHER);
-    sceGuEnable(GU_ALPHA_TEST);
-    sceGuEnable(GU_SCISSOR_TEST);
-    sceGuEnable(GU_BLEND);
+    dlist->n++;
 
-    g2dResetGlobalScale();
-    g2dResetScissor();
+    sceKernelDcacheWritebackRange(seg->data, seg->size);
 
-    sceGuFinish();
-    sceGuSync(0, 0);
-    sceDisplayWaitVblankStart();
-    sceGuDisplay(GU_TRUE);
+    if (batch != NULL)
+    {
+        sceGuStart(GU_CALL, seg->data);
+    }
+    else if (!frame_async)
+    {
+        sceGuStart(GU_DIRECT, seg->data);
+    }
+    else
+    {
+        sceGuStart(GU_SEND, seg->data);
+
+        // While the previous frame is rendered, the displayed buffer
+        // will be the next one to be free.
+        sceGuDrawBufferList(GU_PSM_8888,
+                            vrelptr(in_flight ? g2d_disp_buffer.data :
+                                                g2d_draw_buffer.data),
+                            LINE_SIZE);
+    }
 
-    init = true;
+    return true;
 }
 
 
-void g2dTerm()
+bool _g2dReserve(unsigned int size)
 {
-    if (!init)
-        return;
- 
-    sceGuTerm();
+    DlistSegment *seg;
+    unsigned int seg_size = (batch != NULL ? BATCH_SIZE : DLIST_SIZE);
 
-    free(dlist);
-    
-    init = false;
-}
+    if (!start && batch == NULL)
+        return true;
 
-void g2dClear(g2dColor color)
-{
-    if (!start)
-        _g2dStart();
+    // Keep room for the state & draw commands, and the end of the list.
+    seg = &dlist->seg[dlist->n-1];
+    if (sceGuCheckList() + size + DLIST_MARGIN <= seg->size)
+        return true;
 
-    sceGuClearColor(color);
-    sceGuClear(GU_COLOR_BUFFER_BIT |
-               GU_FAST_CLEAR_BIT |
-               (zclear ? GU_DEPTH_BUFFER_BIT : 0));
+    if (size + DLIST_MARGIN > seg_size)
+        seg_size = size + DLIST_MARGIN;
 
-    zclear = false;
+    // The next segment is allocated first: on failure, nothing is written
+    // and the margin is kept to end the list.
+    if (_g2dGetSegment(dlist, seg_size) == NULL)
+        return false;
+
+    // Chain a new segment. Direct lists are queued as soon as they are
+    // started, send lists are sent all together by g2dFlip(), call lists
+    // are called one after the other.
+    if (batch != NULL)
+    {
+        sceGuFinish();
+    }
+    else
+    {
+        dlist_bytes += sceGuFinish();
+        STATS_ADD(dlist_segments, 1);
+    }
+
+    return _g2dStartSegment(seg_size);
 }
 
 
-void g2dClearZ()
+void* _g2dGetMemory(unsigned int size)
 {
-    if (!start)
-        _g2dStart();
+    if (!_g2dReserve(size))
+        return NULL;
 
-    sceGuClear(GU_DEPTH_BUFFER_BIT | GU_FAST_CLEAR_BIT);
-    zclear = true;
+    return sceGuGetMemory(size);
 }
 
 
-void _g2dBeginCommon(Obj_Type type, g2dTexture *tex)
+bool _g2dStart()
 {
-    if (begin)
-        return;
+    if (!init)
+        g2dInit();
 
-    if (!start)
-        _g2dStart();
+    if (!init)
+        return false;
 
-    // Reset render context
-    rctx.obj = realloc(rctx.obj, MALLOC_STEP * sizeof(Object));
-    rctx.n = 0;
-    rctx.type = type;
-    rctx.tex = tex;
-    rctx.use_strip = false;
-    rctx.use_z = false;
-    rctx.use_vert_color = false;
-    rctx.use_rot = false;
-    rctx.use_tex_linear = true;
-    rctx.use_tex_repeat = false;
-    rctx.use_int = false;
-    rctx.color_count = 0;
-    rctx.coord_mode = DEFAULT_COORD_MODE;
-    
-    // Reset current object
-    g2dReset();
+    frame_async = async;
 
-    begin = true;
-}
+    // The other lists are only allocated when needed.
+    dlist = &dlists[frame_async ? dlist_i : 0];
+    dlist->n = 0;
+    dlist_bytes = 0;
 
+    if (!_g2dStartSegment(DLIST_SIZE))
+        return false;
 
-void g2dBeginRects(g2dTexture *tex)
-{
-    _g2dBeginCommon(RECTS, tex);
-}
+    start = true;
+    STATS_ADD(dlist_segments, 1);
 
+    // Don't trust the state left by the previous frame.
+    gu_state.valid = false;
+    gu_state.tex_valid = false;
 
-void g2dBeginLines(g2dLine_Mode mode)
-{
-    _g2dBeginCommon(LINES, NULL);
-    
-    rctx.use_strip = (mode & G2D_STRIP);
+    return true;
 }
 
 
-void g2dBeginQuads(g2dTexture *tex)
+/* VRAM pool */
+
+void _g2dVramRemove(unsigned int i)
 {
-    _g2dBeginCommon(QUADS, tex);
-}
+    if (vram_ents[i].data != NULL)
+        vram_bytes -= vram_ents[i].size;
 
+    // The texture will be loaded again from its data.
+    if (gu_state.tex == vram_ents[i].tex)
+        gu_state.tex = NULL;
 
-void g2dBeginPoints()
-{
-    _g2dBeginCommon(POINTS, NULL);
+    vram_ents[i] = vram_ents[--vram_n];
 }
 
 
-void _g2dEndRects()
+void _g2dVramDrop(g2dTexture *tex)
 {
-    // Define vertices properties
-    int v_prim = (rctx.use_rot ? GU_TRIANGLES : GU_SPRITES);
-    int v_obj_nbr = (rctx.use_rot ? 6 : 2);
-    int v_nbr;
-    int v_coord_size = 3;
-    int v_tex_size = (rctx.tex != NULL ? 2 : 0);
-    int v_color_size = (rctx.use_vert_color ? 1 : 0);
-    int v_size = v_tex_size * sizeof(short) +
-                 v_color_size * sizeof(g2dColor) +
-                 v_coord_size * sizeof(float);
-    int v_type = GU_VERTEX_32BITF | GU_TRANSFORM_2D;
-    int i;
-
-    if (rctx.tex != NULL)    v_type |= GU_TEXTURE_16BIT;
-    if (rctx.use_vert_color) v_type |= GU_COLOR_8888;
+    unsigned int i;
 
-    // Count how many vertices to allocate.
-    if (rctx.tex == NULL || rctx.use_rot) // No slicing
-    {
-        v_nbr = v_obj_nbr * rctx.n;
-    }
-    else // Can use texture slicing for tremendous performance :)
+    for (i=0; i<vram_n; i++)
     {
-        v_nbr = 0;
-
-        for (i=0; i<rctx.n; i++)
+        if (vram_ents[i].tex == tex)
         {
-            v_nbr += v_obj_nbr * ceilf(OBJ_I.crop_w/SLICE_WIDTH);
+            _g2dVramRemove(i);
+            return;
         }
     }
+}
 
-    // Allocate vertex list memory
-    void *v = sceGuGetMemory(v_nbr * v_size);
-    void *vi = v;
 
-    // Build the vertex list
-    for (i=0; i<rctx.n; i+=1)
+bool _g2dVramAlloc(unsigned int size, unsigned int *offset)
+{
+    unsigned int i, j, start;
+    bool found = false;
+
+    // Lowest free range, at the pool start or right after a texture.
+    for (i=0; i<=vram_n; i++)
     {
-        if (rctx.use_rot) // Two triangles per object
-        {
-            vi = _g2dSetVertex(vi, i, 0.f, 0.f);
-            vi = _g2dSetVertex(vi, i, 1.f, 0.f);
-            vi = _g2dSetVertex(vi, i, 0.f, 1.f);
-            vi = _g2dSetVertex(vi, i, 0.f, 1.f);
-            vi = _g2dSetVertex(vi, i, 1.f, 0.f);
-            vi = _g2dSetVertex(vi, i, 1.f, 1.f);
-        }
-        else if (rctx.tex == NULL) // One sprite per object
+        if (i < vram_n && vram_ents[i].data == NULL)
+            continue;
+
+        start = (i < vram_n ? vram_ents[i].offset + vram_ents[i].size :
+                              VRAM_POOL_START);
+
+        if (start + size > VRAM_SIZE || (found && start >= *offset))
+            continue;
+
+        for (j=0; j<vram_n; j++)
         {
-            vi = _g2dSetVertex(vi, i, 0.f, 0.f);
-            vi = _g2dSetVertex(vi, i, 1.f, 1.f);
+            if (vram_ents[j].data != NULL &&
+                vram_ents[j].offset < start + size &&
+                vram_ents[j].offset + vram_ents[j].size > start)
+                break;
         }
-        else // Several sprites per object for a better texture cache use
-        {
-            float step = SLICE_WIDTH/OBJ_I.crop_w;
-            float u;
 
-            for (u=0.f; u<1.f; u+=step)
-            {
-                vi = _g2dSetVertex(vi, i, u, 0.f);
-                vi = _g2dSetVertex(vi, i, (u+step>1.f ? 1.f : u+step), 1.f);
-            }
+        if (j == vram_n)
+        {
+            *offset = start;
+            found = true;
         }
     }
 
-    // Then put it in the display list.
-    sceGuDrawArray(v_prim, v_type, v_nbr, NULL, v);
+    return found;
 }
 
 
-void _g2dEndLines()
+g2dColor* _g2dVramPromote(g2dTexture *tex)
 {
-    // Define vertices properties
-    int v_prim = (rctx.use_strip ? GU_LINE_STRIP : GU_LINES);
-    int v_obj_nbr = (rctx.use_strip ? 1 : 2);
-    int v_nbr = v_obj_nbr * (rctx.use_strip ? rctx.n : rctx.n/2);
-    int v_coord_size = 3;
-    int v_color_size = (rctx.use_vert_color ? 1 : 0);
-    int v_size = v_color_size * sizeof(g2dColor) +
-                 v_coord_size * sizeof(float);
-    int v_type = GU_VERTEX_32BITF | GU_TRANSFORM_2D;
-    int i;
-
-    if (rctx.use_vert_color) v_type |= GU_COLOR_8888;
+    unsigned int size = _g2dTexSize(tex);
+    unsigned int i, lru, offset;
+    VramEntry *e;
 
-    // Allocate vertex list memory
-    void *v = sceGuGetMemory(v_nbr * v_size);
-    void *vi = v;
+    if (size > VRAM_SIZE - VRAM_POOL_START)
+        return NULL;
 
-    // Build the vertex list
-    if (rctx.use_strip)
-    {
-        vi = _g2dSetVertex(vi, 0, 0.f, 0.f);
-
-        for (i=1; i<rctx.n; i+=1)
-        {
-            vi = _g2dSetVertex(vi, i, 0.f, 0.f);
-        }
-    }
-    else
+    // Evict the least recently used textures, not drawn in this frame.
+    while (!_g2dVramAlloc(size, &offset))
     {
-        for (i=0; i+1<rctx.n; i+=2)
+        for (i=0, lru=vram_n; i<vram_n; i++)
         {
-            vi = _g2dSetVertex(vi, i  , 0.f, 0.f);
-            vi = _g2dSetVertex(vi, i+1, 0.f, 0.f);
+            if (vram_ents[i].data != NULL &&
+                vram_ents[i].last_frame != vram_frame &&
+                (lru == vram_n ||
+                 vram_ents[i].last_frame < vram_ents[lru].last_frame))
+                lru = i;
         }
+
+        if (lru == vram_n)
+            return NULL;
+
+        _g2dVramRemove(lru);
     }
 
-    // Then put it in the display list.
-    sceGuDrawArray(v_prim, v_type, v_nbr, NULL, v);
+    for (e=vram_ents; e->tex != tex; e++);
+
+    e->src = tex->data;
+    e->data = vabsptr((void*)(size_t)offset);
+    e->offset = offset;
+    vram_bytes += size;
+
+    // Copied by the GE, in order with the draws reading the pool.
+    sceGuCopyImage(GU_PSM_8888, 0, 0, 512, size / (512*4), 512,
+                   tex->data, 0, 0, 512, e->data);
+    sceGuTexSync();
+
+    return e->data;
 }
 
 
-void _g2dEndQuads()
+g2dColor* _g2dVramTexData(g2dTexture *tex)
 {
-    // Define vertices properties
-    int v_prim = GU_TRIANGLES;
-    int v_obj_nbr = 6;
-    int v_nbr = v_obj_nbr * (rctx.n / 4);
-    int v_coord_size = 3;
-    int v_tex_size = (rctx.tex != NULL ? 2 : 0);
-    int v_color_size = (rctx.use_vert_color ? 1 : 0);
-    int v_size = v_tex_size * sizeof(short) +
-                 v_color_size * sizeof(g2dColor) +
-                 v_coord_size * sizeof(float);
-    int v_type = GU_VERTEX_32BITF | GU_TRANSFORM_2D;
-    int i;
-
-    if (rctx.tex != NULL)    v_type |= GU_TEXTURE_16BIT;
-    if (rctx.use_vert_color) v_type |= GU_COLOR_8888;
+    VramEntry *e, *ents;
+    g2dColor *data;
+    unsigned int i;
 
-    // Allocate vertex list memory
-    void *v = sceGuGetMemory(v_nbr * v_size);
-    void *vi = v;
+    // Batches can be called after an eviction, they stay in RAM.
+    // Textures which fit in the texture cache are only read once.
+    if (!vram_pool || batch != NULL || _g2dTexSize(tex) <= TEX_CACHE_SIZE)
+        return tex->data;
 
-    // Build the vertex list
-    for (i=0; i+3<rctx.n; i+=4)
+    for (i=0; i<vram_n && vram_ents[i].tex != tex; i++);
+
+    // The data has been replaced since the upload.
+    if (i < vram_n && vram_ents[i].data != NULL &&
+        vram_ents[i].src != tex->data)
     {
-        vi = _g2dSetVertex(vi, i  , 0.f, 0.f);
-        vi = _g2dSetVertex(vi, i+1, 1.f, 0.f);
-        vi = _g2dSetVertex(vi, i+3, 0.f, 1.f);
-        vi = _g2dSetVertex(vi, i+3, 0.f, 1.f);
-        vi = _g2dSetVertex(vi, i+1, 1.f, 0.f);
-        vi = _g2dSetVertex(vi, i+2, 1.f, 1.f);
+        _g2dVramRemove(i);
+        i = vram_n;
     }
 
-    // Then put it in the display list.
-    sceGuDrawArray(v_prim, v_type, v_nbr, NULL, v);
-}
+    if (i == vram_n)
+    {
+        if (vram_n == vram_size)
+        {
+            ents = realloc(vram_ents,
+                           (vram_size + MALLOC_STEP) * sizeof(VramEntry));
+            if (ents == NULL)
+                return tex->data;
 
+            vram_ents = ents;
+            vram_size += MALLOC_STEP;
+        }
 
-void _g2dEndPoints()
-{
-    // Define vertices properties
-    int v_prim = GU_POINTS;
-    int v_obj_nbr = 1;
-    int v_nbr = v_obj_nbr * rctx.n;
-    int v_coord_size = 3;
-    int v_color_size = (rctx.use_vert_color ? 1 : 0);
-    int v_size = v_color_size * sizeof(g2dColor) +
-                 v_coord_size * sizeof(float);
-    int v_type = GU_VERTEX_32BITF | GU_TRANSFORM_2D;
-    int i;
+        i = vram_n++;
+        memset(&vram_ents[i], 0, sizeof(VramEntry));
+        vram_ents[i].tex = tex;
+        vram_ents[i].size = _g2dTexSize(tex);
+        vram_ents[i].last_frame = vram_frame - 1;
+    }
 
-    if (rctx.use_vert_color) v_type |= GU_COLOR_8888;
+    e = &vram_ents[i];
 
-    // Allocate vertex list memory
-    void *v = sceGuGetMemory(v_nbr * v_size);
-    void *vi = v;
+    if (e->last_frame != vram_frame)
+    {
+        e->frames = (e->last_frame + 1 == vram_frame ? e->frames + 1 : 1);
+        e->last_frame = vram_frame;
+    }
 
-    // Build the vertex list
-    for (i=0; i<rctx.n; i+=1)
+    if (e->data != NULL)
     {
-        vi = _g2dSetVertex(vi, i, 0.f, 0.f);
+        STATS_ADD(vram_hits, 1);
+        return e->data;
     }
 
-    // Then put it in the display list.
-    sceGuDrawArray(v_prim, v_type, v_nbr, NULL, v);
+    STATS_ADD(vram_misses, 1);
+
+    // Promoted when drawn in a few frames in a row.
+    if (e->frames >= VRAM_PROMOTE_FRAMES &&
+        (data = _g2dVramPromote(tex)) != NULL)
+        return data;
+
+    return tex->data;
 }
 
 
-void g2dEnd()
+void _g2dVramEndFrame()
 {
-    if (!begin || rctx.n == 0)
+    unsigned int i;
+
+    // Candidates not drawn in this frame start over. The last entry takes
+    // the place of a removed one, which is checked again.
+    i = 0;
+    while (i < vram_n)
     {
-        begin = false;
-        return;
+        if (vram_ents[i].data == NULL && vram_ents[i].last_frame != vram_frame)
+            _g2dVramRemove(i);
+        else
+            i++;
     }
 
-    // Manage pspgu extensions
+    vram_frame++;
+}
 
-    if (rctx.use_z)
-        sceGuEnable(GU_DEPTH_TEST);
-    else
-        sceGuDisable(GU_DEPTH_TEST);
 
-    if (rctx.use_vert_color)
-        sceGuColor(WHITE);
-    else
-        sceGuColor(rctx.cur_obj.color);
+void _g2dSetGuState()
+{
+    // Only send what differs from the last batch.
+    bool force = !gu_state.valid;
+    g2dColor color = (rctx.use_vert_color ? WHITE : rctx.cur_obj.color);
 
-    if (rctx.tex == NULL)
-        sceGuDisable(GU_TEXTURE_2D);
-    else
+    if (force || gu_state.depth_test != rctx.use_z)
+    {
+        if (rctx.use_z)
+            sceGuEnable(GU_DEPTH_TEST);
+        else
+            sceGuDisable(GU_DEPTH_TEST);
+
+        gu_state.depth_test = rctx.use_z;
+        STATS_ADD(state_changes, 1);
+    }
+
+    if (force || gu_state.color != color)
     {
-        sceGuEnable(GU_TEXTURE_2D);
+        sceGuColor(color);
+
+        gu_state.color = color;
+        STATS_ADD(state_changes, 1);
+    }
+
+    if (force || gu_state.texture_2d != (rctx.tex != NULL))
+    {
+        if (rctx.tex == NULL)
+            sceGuDisable(GU_TEXTURE_2D);
+        else
+            sceGuEnable(GU_TEXTURE_2D);
+
+        gu_state.texture_2d = (rctx.tex != NULL);
+        STATS_ADD(state_changes, 1);
+    }
+
+    gu_state.valid = true;
+
+    if (rctx.tex == NULL)
+        return;
 
+    // Texture states are only known once a texture has been used.
+    force = !gu_state.tex_valid;
+
+    if (force || gu_state.tex_linear != rctx.use_tex_linear)
+    {
         if (rctx.use_tex_linear) sceGuTexFilter(GU_LINEAR, GU_LINEAR);
         else                     sceGuTexFilter(GU_NEAREST, GU_NEAREST);
 
+        gu_state.tex_linear = rctx.use_tex_linear;
+        STATS_ADD(state_changes, 1);
+    }
+
+    if (force || gu_state.tex_repeat != rctx.use_tex_repeat)
+    {
         if (rctx.use_tex_repeat) sceGuTexWrap(GU_REPEAT, GU_REPEAT);
         else                     sceGuTexWrap(GU_CLAMP, GU_CLAMP);
 
-        // Load texture
-        sceGuTexMode(GU_PSM_8888, 0, 0, rctx.tex->swizzled);
-        sceGuTexImage(0, rctx.tex->tw, rctx.tex->th,
-                      rctx.tex->tw, rctx.tex->data);
+        gu_state.tex_repeat = rctx.use_tex_repeat;
+        STATS_ADD(state_changes, 1);
     }
 
-    switch (rctx.type)
+    // Load texture, this also flushes the texture cache.
+    if (force || gu_state.tex != rctx.tex ||
+                 gu_state.tex_data != rctx.tex->data ||
+                 gu_state.tex_swizzled != rctx.tex->swizzled)
     {
-        case RECTS:
-            _g2dEndRects();
-            break;
-
-        case LINES:
-            _g2dEndLines();
-            break;
-
-        case QUADS:
-            _g2dEndQuads();
-            break;
+        sceGuTexMode(rctx.tex->psm, 0, 0, rctx.tex->swizzled);
+        sceGuTexImage(0, rctx.tex->tw, rctx.tex->th,
+                      rctx.tex->tw, _g2dVramTexData(rctx.tex));
 
-        case POINTS:
-            _g2dEndPoints();
-            break;
+        gu_state.tex = rctx.tex;
+        gu_state.tex_data = rctx.tex->data;
+        gu_state.tex_swizzled = rctx.tex->swizzled;
+        STATS_ADD(state_changes, 2);
     }
 
-    sceGuColor(WHITE);
+    // Palettes are copied to the CLUT cache when loaded.
+    if (rctx.tex->clut != NULL && (force || gu_state.clut != rctx.tex->clut))
+    {
+        sceGuClutMode(GU_PSM_8888, 0, 0xFF, 0);
+        sceGuClutLoad((rctx.tex->psm == GU_PSM_T4 ? 16 : 256) / 8,
+                      rctx.tex->clut);
 
-    if (rctx.use_z)
-        zclear = true;
+        gu_state.clut = rctx.tex->clut;
+        STATS_ADD(state_changes, 2);
+    }
 
-    begin = false;
+    gu_state.tex_valid = true;
 }
 
 
-void g2dReset()
+void _g2dRestoreColor()
 {
-    g2dResetCoord();
-    g2dResetScale();
-    g2dResetColor();
-    g2dResetAlpha();
-    g2dResetRotation();
-    g2dResetCrop();
-    g2dResetTex();
+    // pspgu code drawn after gLib2D (intraFont...) expects a white color.
+    if (gu_state.color != WHITE)
+    {
+        sceGuColor(WHITE);
+
+        gu_state.color = WHITE;
+        STATS_ADD(state_changes, 1);
+    }
 }
 
+/* Object store */
 
-void g2dFlip(g2dFlip_Mode mode)
+bool _g2dObjReserve(unsigned int n)
 {
-    if (scissor)
-        g2dResetScissor();
+    unsigned int nbr = sizeof(obj_fields) / sizeof(void**);
+    unsigned int size = (objs.size > 0 ? objs.size : OBJ_STORE_SIZE);
+    u32 *data;
+    unsigned int i;
 
-    sceGuFinish();
-    sceGuSync(0, 0);
+    if (n <= objs.size)
+        return true;
 
-    if (mode & G2D_VSYNC)
-        sceDisplayWaitVblankStart();
+    // Only grows, the store is kept from a frame to another.
+    while (size < n)
+        size *= 2;
 
-    g2d_disp_buffer.data = g2d_draw_buffer.data;
-    g2d_draw_buffer.data = vabsptr(sceGuSwapBuffers());
+    // All the fields are 32-bit wide.
+    if ((data = malloc(nbr * size * sizeof(u32))) == NULL)
+        return false;
 
-    start = false;
+    for (i=0; i<nbr; i++)
+    {
+        if (objs.n > 0)
+            memcpy(data + i*size, *obj_fields[i], objs.n * sizeof(u32));
+
+        *obj_fields[i] = data + i*size;
+    }
+
+    free(objs.data);
+    objs.data = data;
+    objs.size = size;
+
+    return true;
 }
 
 
-void g2dAdd()
+void _g2dObjMoveFirst(unsigned int first, unsigned int n)
 {
-    if (!begin || rctx.cur_obj.scale_w == 0.f || rctx.cur_obj.scale_h == 0.f)
-        return;
+    unsigned int nbr = sizeof(obj_fields) / sizeof(void**);
+    unsigned int i;
 
-    if (rctx.n % MALLOC_STEP == 0)
+    // The objects before them are dropped, the store ends with them.
+    if (first > 0)
     {
-        rctx.obj = realloc(rctx.obj,
-                           (rctx.n+MALLOC_STEP) * sizeof(Object));
+        for (i=0; i<nbr; i++)
+        {
+            memmove(*obj_fields[i], (u32*)*obj_fields[i] + first,
+                    n * sizeof(u32));
+        }
     }
-    
-    rctx.n++;
-    OBJ = rctx.cur_obj;
+
+    objs.n = n;
+}
+
+
+void _g2dObjStore(unsigned int i, const Object *obj)
+{
+    float x = obj->x;
+    float y = obj->y;
 
     // Coordinate mode stuff
-    OBJ.rot_x = OBJ.x;
-    OBJ.rot_y = OBJ.y;
-    
     switch (rctx.coord_mode)
     {
         case G2D_UP_RIGHT:
-            OBJ.x -= OBJ.scale_w;
+            x -= obj->scale_w;
             break;
 
         case G2D_DOWN_RIGHT:
-            OBJ.x -= OBJ.scale_w;
-            OBJ.y -= OBJ.scale_h;
+            x -= obj->scale_w;
+            y -= obj->scale_h;
             break;
 
         case G2D_DOWN_LEFT:
-            OBJ.y -= OBJ.scale_h;
+            y -= obj->scale_h;
             break;
 
         case G2D_CENTER:
-            OBJ.x -= OBJ.scale_w / 2.f;
-            OBJ.y -= OBJ.scale_h / 2.f;
+            x -= obj->scale_w / 2.f;
+            y -= obj->scale_h / 2.f;
             break;
             
         case G2D_UP_LEFT:
@@ -691,485 +921,2799 @@ void g2dAdd()
             break;
     };
 
+    if (rctx.use_rot) // Up left corner, rotated around the coordinates.
+    {
+        x -= obj->x;
+        y -= obj->y;
+        objs.x[i] = obj->x + obj->rot_cos*x - obj->rot_sin*y;
+        objs.y[i] = obj->y + obj->rot_sin*x + obj->rot_cos*y;
+        objs.m00[i] = obj->rot_cos;
+        objs.m01[i] = -obj->rot_sin;
+        objs.m10[i] = obj->rot_sin;
+        objs.m11[i] = obj->rot_cos;
+    }
+    else
+    {
+        objs.x[i] = x;
+        objs.y[i] = y;
+    }
+
+    objs.z[i] = obj->z;
+    objs.w[i] = obj->scale_w;
+    objs.h[i] = obj->scale_h;
+
     // Alpha stuff
-    OBJ.color = G2D_MODULATE(OBJ.color, 255, rctx.cur_obj.alpha);
+    objs.color[i] = G2D_MODULATE(obj->color, 255, obj->alpha);
+
+    if (rctx.tex != NULL)
+    {
+        objs.crop_x[i] = obj->crop_x;
+        objs.crop_y[i] = obj->crop_y;
+        objs.crop_w[i] = obj->crop_w;
+        objs.crop_h[i] = obj->crop_h;
+    }
 }
 
 
-void g2dPush()
+void _g2dObjFillRot()
 {
-    if (tstack_size >= TSTACK_MAX)
-        return;
+    unsigned int i;
 
-    tstack_size++;
+    // Objects added before the first rotation are not rotated.
+    for (i=rctx.first+rctx.rot_n; i<rctx.first+rctx.n; i++)
+    {
+        objs.m00[i] = 1.f;
+        objs.m01[i] = 0.f;
+        objs.m10[i] = 0.f;
+        objs.m11[i] = 1.f;
+    }
 
-    TRANSFORM.x = rctx.cur_obj.x;
-    TRANSFORM.y = rctx.cur_obj.y;
-    TRANSFORM.z = rctx.cur_obj.z;
-    TRANSFORM.rot = rctx.cur_obj.rot;
-    TRANSFORM.rot_sin = rctx.cur_obj.rot_sin;
-    TRANSFORM.rot_cos = rctx.cur_obj.rot_cos;
-    TRANSFORM.scale_w = rctx.cur_obj.scale_w;
-    TRANSFORM.scale_h = rctx.cur_obj.scale_h;
+    rctx.rot_n = rctx.n;
 }
 
 
-void g2dPop()
+void _g2dObjTransform(const Matrix *m, unsigned int i, unsigned int n)
 {
-    if (tstack_size <= 0)
-        return;
+    float x, y, m00, m01;
 
-    rctx.cur_obj.x = TRANSFORM.x;
-    rctx.cur_obj.y = TRANSFORM.y;
-    rctx.cur_obj.z = TRANSFORM.z;
-    rctx.cur_obj.rot = TRANSFORM.rot;
-    rctx.cur_obj.rot_sin = TRANSFORM.rot_sin;
-    rctx.cur_obj.rot_cos = TRANSFORM.rot_cos;
-    rctx.cur_obj.scale_w = TRANSFORM.scale_w;
-    rctx.cur_obj.scale_h = TRANSFORM.scale_h;
+    for (n+=i; i<n; i++)
+    {
+        x = objs.x[i];
+        y = objs.y[i];
+        objs.x[i] = m->a*x + m->b*y + m->x;
+        objs.y[i] = m->c*x + m->d*y + m->y;
 
-    tstack_size--;
-    
-    if (rctx.cur_obj.rot != 0.f) rctx.use_rot = true;
-    if (rctx.cur_obj.z != 0.f)   rctx.use_z = true;
+        if (rctx.use_rot) // Compose the linear parts
+        {
+            m00 = objs.m00[i];
+            m01 = objs.m01[i];
+            objs.m00[i] = m->a*m00 + m->b*objs.m10[i];
+            objs.m01[i] = m->a*m01 + m->b*objs.m11[i];
+            objs.m10[i] = m->c*m00 + m->d*objs.m10[i];
+            objs.m11[i] = m->c*m01 + m->d*objs.m11[i];
+        }
+        else // Axis aligned, see _g2dMatRun()
+        {
+            objs.w[i] *= m->a;
+            objs.h[i] *= m->d;
+        }
+    }
 }
 
-/* Coord functions */
 
-void g2dResetCoord()
+bool _g2dMatIdentity(const Matrix *m)
 {
-    rctx.cur_obj.x = DEFAULT_X;
-    rctx.cur_obj.y = DEFAULT_Y;
-    rctx.cur_obj.z = DEFAULT_Z;
+    return m->a == 1.f && m->b == 0.f && m->x == 0.f &&
+           m->c == 0.f && m->d == 1.f && m->y == 0.f;
 }
 
 
-void g2dSetCoordMode(g2dCoord_Mode mode)
+bool _g2dMatRun(unsigned int i)
 {
-    if (mode > G2D_CENTER)
-        return;
+    MatRun *runs;
+    unsigned int size;
 
-    rctx.coord_mode = mode;
-}
+    // Objects before the first run are not transformed.
+    if (mat_run_n == 0 && _g2dMatIdentity(&mat))
+    {
+        mat_dirty = false;
+        return true;
+    }
 
+    if (mat_run_n == mat_run_size)
+    {
+        size = (mat_run_size > 0 ? 2*mat_run_size : MAT_RUN_SIZE);
+        if ((runs = realloc(mat_runs, size * sizeof(MatRun))) == NULL)
+            return false;
 
-void g2dGetCoordXYZ(float *x, float *y, float *z)
-{
-    if (x != NULL) *x = rctx.cur_obj.x;
-    if (y != NULL) *y = rctx.cur_obj.y;
-    if (z != NULL) *z = rctx.cur_obj.z;
-}
+        mat_runs = runs;
+        mat_run_size = size;
+    }
 
+    mat_dirty = false;
+    mat_runs[mat_run_n].first = i;
+    mat_runs[mat_run_n].m = mat;
+    mat_run_n++;
 
-void g2dSetCoordXY(float x, float y)
-{
-    rctx.cur_obj.x = x * global_scale;
-    rctx.cur_obj.y = y * global_scale;
-    rctx.cur_obj.z = 0.f;
+    // Rotated, skewed or mirrored rects can't be drawn with sprites.
+    if (!MAT_AXIS_ALIGNED(mat))
+        rctx.use_rot = true;
+
+    return true;
 }
 
 
-void g2dSetCoordXYZ(float x, float y, float z)
+void _g2dObjPrepare()
 {
-    rctx.cur_obj.x = x * global_scale;
-    rctx.cur_obj.y = y * global_scale;
-    rctx.cur_obj.z = z * global_scale;
+    unsigned int i, end;
 
-    if (z != 0.f)
-        rctx.use_z = true;
+    if (rctx.use_rot && rctx.rot_n < rctx.n)
+        _g2dObjFillRot();
+
+    // One pass per matrix, over consecutive objects.
+    for (i=0; i<mat_run_n; i++)
+    {
+        end = (i+1 < mat_run_n ? mat_runs[i+1].first : rctx.first + rctx.n);
+
+        if (!_g2dMatIdentity(&mat_runs[i].m))
+            _g2dObjTransform(&mat_runs[i].m, mat_runs[i].first,
+                             end - mat_runs[i].first);
+    }
+
+    mat_run_n = 0;
+    mat_dirty = true;
 }
 
 
-void g2dSetCoordXYRelative(float x, float y)
+int _g2dCullGroup()
 {
-    float inc_x = x;
-    float inc_y = y;
+    // Objects dropped together: a rect, a point, a line or a quad.
+    // A batch can be drawn anywhere.
+    if (batch != NULL || !use_cull)
+        return 0;
 
-    if (rctx.cur_obj.rot_cos != 1.f)
+    switch (rctx.type)
     {
-        inc_x = -rctx.cur_obj.rot_sin*y + rctx.cur_obj.rot_cos*x;
-        inc_y =  rctx.cur_obj.rot_cos*y + rctx.cur_obj.rot_sin*x;
-    }
+        case RECTS:
+        case POINTS:
+            return 1;
 
-    rctx.cur_obj.x += inc_x * global_scale;
-    rctx.cur_obj.y += inc_y * global_scale;
+        case LINES:
+            return (rctx.use_strip ? 0 : 2);
+
+        case QUADS:
+            return 4;
+
+        case MESH:
+        default:
+            return 0;
+    }
 }
 
 
-void g2dSetCoordXYZRelative(float x, float y, float z)
+bool _g2dObjCulled(unsigned int i, unsigned int n)
 {
-    g2dSetCoordXYRelative(x, y);
+    float x0 = 0.f, y0 = 0.f, x1 = 0.f, y1 = 0.f;
+    float cx, cy, hx, hy, w, h;
+    unsigned int k;
 
-    rctx.cur_obj.z += z * global_scale;
+    // Bounding box before the matrix, from the stored up left corner.
+    for (k=i; k<i+n; k++)
+    {
+        cx = objs.x[k];
+        cy = objs.y[k];
+        hx = hy = 0.f;
 
-    if (z != 0.f)
-        rctx.use_z = true;
-}
+        if (rctx.type == RECTS)
+        {
+            w = objs.w[k] / 2.f;
+            h = objs.h[k] / 2.f;
 
+            if (rctx.use_rot)
+            {
+                cx += objs.m00[k]*w + objs.m01[k]*h;
+                cy += objs.m10[k]*w + objs.m11[k]*h;
+                hx = fabsf(objs.m00[k]*w) + fabsf(objs.m01[k]*h);
+                hy = fabsf(objs.m10[k]*w) + fabsf(objs.m11[k]*h);
+            }
+            else
+            {
+                cx += w;
+                cy += h;
+                hx = fabsf(w);
+                hy = fabsf(h);
+            }
+        }
 
-void g2dSetCoordInteger(bool use)
-{
-    rctx.use_int = use;
+        if (k == i || cx - hx < x0) x0 = cx - hx;
+        if (k == i || cy - hy < y0) y0 = cy - hy;
+        if (k == i || cx + hx > x1) x1 = cx + hx;
+        if (k == i || cy + hy > y1) y1 = cy + hy;
+    }
+
+    // Then through the matrix, as it will be in _g2dObjPrepare().
+    cx = (x0 + x1) / 2.f;
+    cy = (y0 + y1) / 2.f;
+    w = (x1 - x0) / 2.f;
+    h = (y1 - y0) / 2.f;
+    hx = fabsf(mat.a)*w + fabsf(mat.b)*h;
+    hy = fabsf(mat.c)*w + fabsf(mat.d)*h;
+    x0 = mat.a*cx + mat.b*cy + mat.x;
+    y0 = mat.c*cx + mat.d*cy + mat.y;
+
+    // A pixel of margin for the rounding of integer coordinates.
+    return x0 + hx < clip[0] - 1.f || x0 - hx > clip[2] + 1.f ||
+           y0 + hy < clip[1] - 1.f || y0 - hy > clip[3] + 1.f;
 }
 
-/* Scale functions */
 
-void g2dResetGlobalScale()
+void _g2dObjCull(unsigned int g)
 {
-    global_scale = 1.f;
-}
+    unsigned int i = rctx.first + rctx.n - g;
 
+    rctx.n -= g;
+    objs.n = i;
 
-void g2dResetScale()
-{
-    if (rctx.tex == NULL)
-    {
-        rctx.cur_obj.scale_w = DEFAULT_SIZE;
-        rctx.cur_obj.scale_h = DEFAULT_SIZE;
-    }
-    else
+    if (rctx.rot_n > rctx.n)
+        rctx.rot_n = rctx.n;
+
+    // A matrix run started by these objects restarts with the next one.
+    while (mat_run_n > 0 && mat_runs[mat_run_n-1].first >= i)
     {
-        rctx.cur_obj.scale_w = rctx.tex->w;
-        rctx.cur_obj.scale_h = rctx.tex->h;
+        mat_run_n--;
+        mat_dirty = true;
     }
 
-    rctx.cur_obj.scale_w *= global_scale;
-    rctx.cur_obj.scale_h *= global_scale;
+    STATS_ADD(culled, g);
 }
 
 
-void g2dGetGlobalScale(float *scale)
+int _g2dSliceWidth(const g2dTexture *tex, bool rotated)
 {
-    if (scale != NULL)
-        *scale = global_scale;
+    int bits = _g2dTexBits(tex->psm);
+
+    if (slice_force > 0)
+        return slice_force;
+
+    // Swizzled, texels are read by blocks of 16 bytes * 8 rows, the slices
+    // can be wider. Rotated, they become strips.
+    if (tex->swizzled)
+        return SLICE_BYTES_SWIZZLED * 8 / bits;
+
+    // Unswizzled, the 64 texels of 32 bits long used on the PSP, as bytes.
+    // Rotated, each scanline crosses the rows of a strip: nothing shows
+    // that it helps, the texture is not sliced.
+    return (rotated ? tex->tw : SLICE_BYTES * 8 / bits);
 }
 
 
-void g2dGetScaleWH(float *w, float *h)
+void _g2dSetSliceWidth(int w)
 {
-    if (w != NULL) *w = rctx.cur_obj.scale_w;
-    if (h != NULL) *h = rctx.cur_obj.scale_h;
+    slice_force = w;
 }
 
 
-void g2dSetGlobalScale(float scale)
+void _g2dSetCulling(bool use)
 {
-    global_scale = scale;
+    use_cull = use;
 }
 
 
-void g2dSetScale(float w, float h)
+void _g2dSetClipping(bool use)
 {
-    g2dResetScale();
-
-    g2dSetScaleRelative(w, h);
+    use_clip = use;
 }
 
 
-void g2dSetScaleWH(float w, float h)
+static INLINE int _g2dObjSliceWidth(unsigned int i)
 {
-    rctx.cur_obj.scale_w = w * global_scale;
-    rctx.cur_obj.scale_h = h * global_scale;
+    // Crops fitting in the texture cache don't need to be sliced.
+    if (slice_force == 0 && objs.crop_w[i] * objs.crop_h[i] *
+                            _g2dTexBits(rctx.tex->psm) <= TEX_CACHE_SIZE*8)
+        return objs.crop_w[i];
 
-    // A trick to prevent an unexpected behavior when mirroring with GU_SPRITES.
-    if (rctx.cur_obj.scale_w < 0 || rctx.cur_obj.scale_h < 0)
-        rctx.use_rot = true;
+    return rctx.slice_w;
 }
 
 
-void g2dSetScaleRelative(float w, float h)
+void _g2dObjClip(unsigned int i, unsigned int n)
 {
-    rctx.cur_obj.scale_w *= w;
-    rctx.cur_obj.scale_h *= h;
+    float s;
+    int t, slice;
 
-    if (rctx.cur_obj.scale_w < 0 || rctx.cur_obj.scale_h < 0)
-        rctx.use_rot = true;
-}
+    // Textured sprites, already in screen space (see _g2dObjPrepare()).
+    // Whole slices out of the scissor are cut, the other ones keep their
+    // texels and position.
+    if (batch != NULL || !use_clip)
+        return;
 
+    for (n+=i; i<n; i++)
+    {
+        slice = _g2dObjSliceWidth(i);
 
-void g2dSetScaleWHRelative(float w, float h)
-{
-    rctx.cur_obj.scale_w += w * global_scale;
-    rctx.cur_obj.scale_h += h * global_scale;
+        if (objs.w[i] <= 0.f || objs.crop_w[i] <= slice)
+            continue;
 
-    if (rctx.cur_obj.scale_w < 0 || rctx.cur_obj.scale_h < 0)
-        rctx.use_rot = true;
-}
+        s = objs.w[i] / objs.crop_w[i];
+        t = (clip[0] - objs.x[i]) / s;      // Left
+        t = (t < objs.crop_w[i] ? t : objs.crop_w[i]-1) / slice * slice;
 
-/* Color functions */
+        if (t > 0)
+        {
+            objs.x[i] += t * s;
+            objs.w[i] -= t * s;
+            objs.crop_x[i] += t;
+            objs.crop_w[i] -= t;
+        }
 
-void g2dResetColor()
-{
-    rctx.cur_obj.color = DEFAULT_COLOR;
+        t = (clip[2] - objs.x[i]) / s + 1;  // Right, rounded up
+        t = (t > 0 ? (t + slice-1) / slice * slice : slice);
+
+        if (t < objs.crop_w[i])
+        {
+            objs.w[i] = t * s;
+            objs.crop_w[i] = t;
+        }
+    }
 }
 
 
-void g2dResetAlpha()
+int _g2dSliceNbr(unsigned int i, unsigned int n)
 {
-    rctx.cur_obj.alpha = DEFAULT_ALPHA;
+    int nbr = 0;
+
+    for (n+=i; i<n; i++)
+    {
+        if (objs.crop_w[i] > 0)
+            nbr += (objs.crop_w[i] + _g2dObjSliceWidth(i) - 1) /
+                   _g2dObjSliceWidth(i);
+    }
+
+    return nbr;
 }
 
 
-void g2dGetAlpha(g2dAlpha *alpha)
+void _g2dQuadIndices()
 {
-    if (alpha != NULL)
-        *alpha = rctx.cur_obj.alpha;
+    unsigned short *idx = quad_idx;
+    unsigned int i;
+
+    // Two triangles per quad, sharing the 1-2 diagonal.
+    for (i=0; i<4*INDEX_QUAD_NBR; i+=4)
+    {
+        *(idx++) = i;
+        *(idx++) = i+1;
+        *(idx++) = i+2;
+        *(idx++) = i+2;
+        *(idx++) = i+1;
+        *(idx++) = i+3;
+    }
+
+    sceKernelDcacheWritebackRange(quad_idx, sizeof(quad_idx));
 }
 
+/* Corner kernels */
 
-void g2dSetColor(g2dColor color)
+// Corners of rotated objects: x + L*(u*w, v*h). The results are stored by
+// planes of 'stride' floats: x0 x1 x2 x3 y0 y1 y2 y3, corners being given
+// in the 0,0 / 1,0 / 0,1 / 1,1 order. Every kernel gives the same result.
+
+void _g2dCornersC(unsigned int i, unsigned int n,
+                  float *c, unsigned int stride)
 {
-    rctx.cur_obj.color = color;
+    float aw, cw, bh, dh;
+    unsigned int k;
 
-    if (++rctx.color_count > 1)
-        rctx.use_vert_color = true;
+    for (k=0; k<n; k++, i++)
+    {
+        aw = objs.m00[i] * objs.w[i];
+        cw = objs.m10[i] * objs.w[i];
+        bh = objs.m01[i] * objs.h[i];
+        dh = objs.m11[i] * objs.h[i];
+
+        c[k]          = objs.x[i];
+        c[stride+k]   = objs.x[i] + aw;
+        c[2*stride+k] = objs.x[i] + bh;
+        c[3*stride+k] = objs.x[i] + aw + bh;
+        c[4*stride+k] = objs.y[i];
+        c[5*stride+k] = objs.y[i] + cw;
+        c[6*stride+k] = objs.y[i] + dh;
+        c[7*stride+k] = objs.y[i] + cw + dh;
+    }
 }
 
 
-void g2dSetAlpha(g2dAlpha alpha)
+#if defined(USE_VFPU)
+void _g2dCornersSimd(unsigned int i, unsigned int n,
+                     float *c, unsigned int stride)
 {
-    if (alpha < 0)   alpha = 0;
-    if (alpha > 255) alpha = 255;
+    unsigned int k;
 
-    rctx.cur_obj.alpha = alpha;
+    // Four objects at a time, c is aligned but the objects may not be.
+    for (k=0; k+4<=n; k+=4, i+=4)
+    {
+        __asm__ volatile (
+            "ulv.q  C000, 0(%0)\n"        // x
+            "ulv.q  C010, 0(%1)\n"        // y
+            "ulv.q  C020, 0(%2)\n"        // w
+            "ulv.q  C030, 0(%3)\n"        // h
+            "ulv.q  C100, 0(%4)\n"        // m00
+            "ulv.q  C110, 0(%5)\n"        // m01
+            "ulv.q  C120, 0(%6)\n"        // m10
+            "ulv.q  C130, 0(%7)\n"        // m11
+            "vmul.q C200, C100, C020\n"   // aw
+            "vmul.q C210, C120, C020\n"   // cw
+            "vmul.q C220, C110, C030\n"   // bh
+            "vmul.q C230, C130, C030\n"   // dh
+            "vadd.q C300, C000, C200\n"   // x1 = x + aw
+            "vadd.q C310, C000, C220\n"   // x2 = x + bh
+            "vadd.q C320, C300, C220\n"   // x3 = x1 + bh
+            "vadd.q C330, C010, C210\n"   // y1 = y + cw
+            "vadd.q C400, C010, C230\n"   // y2 = y + dh
+            "vadd.q C410, C330, C230\n"   // y3 = y1 + dh
+            "sv.q   C000, 0(%8)\n"
+            "sv.q   C300, 0(%9)\n"
+            "sv.q   C310, 0(%10)\n"
+            "sv.q   C320, 0(%11)\n"
+            "sv.q   C010, 0(%12)\n"
+            "sv.q   C330, 0(%13)\n"
+            "sv.q   C400, 0(%14)\n"
+            "sv.q   C410, 0(%15)\n"
+            : : "r"(objs.x+i), "r"(objs.y+i), "r"(objs.w+i), "r"(objs.h+i),
+                "r"(objs.m00+i), "r"(objs.m01+i),
+                "r"(objs.m10+i), "r"(objs.m11+i),
+                "r"(c+k), "r"(c+stride+k), "r"(c+2*stride+k),
+                "r"(c+3*stride+k), "r"(c+4*stride+k), "r"(c+5*stride+k),
+                "r"(c+6*stride+k), "r"(c+7*stride+k)
+            : "memory"
+        );
+    }
 
-    if (++rctx.color_count > 1)
-        rctx.use_vert_color = true;
+    _g2dCornersC(i, n-k, c+k, stride);
 }
+#elif defined(__SSE2__)
+void _g2dCornersSimd(unsigned int i, unsigned int n,
+                     float *c, unsigned int stride)
+{
+    __m128 x, y, w, h, aw, cw, bh, dh;
+    unsigned int k;
 
+    // Four objects at a time, c is aligned but the objects may not be.
+    for (k=0; k+4<=n; k+=4, i+=4)
+    {
+        x = _mm_loadu_ps(objs.x + i);
+        y = _mm_loadu_ps(objs.y + i);
+        w = _mm_loadu_ps(objs.w + i);
+        h = _mm_loadu_ps(objs.h + i);
+        aw = _mm_mul_ps(_mm_loadu_ps(objs.m00 + i), w);
+        cw = _mm_mul_ps(_mm_loadu_ps(objs.m10 + i), w);
+        bh = _mm_mul_ps(_mm_loadu_ps(objs.m01 + i), h);
+        dh = _mm_mul_ps(_mm_loadu_ps(objs.m11 + i), h);
+
+        _mm_store_ps(c + k, x);
+        _mm_store_ps(c + stride + k, _mm_add_ps(x, aw));
+        _mm_store_ps(c + 2*stride + k, _mm_add_ps(x, bh));
+        _mm_store_ps(c + 3*stride + k, _mm_add_ps(_mm_add_ps(x, aw), bh));
+        _mm_store_ps(c + 4*stride + k, y);
+        _mm_store_ps(c + 5*stride + k, _mm_add_ps(y, cw));
+        _mm_store_ps(c + 6*stride + k, _mm_add_ps(y, dh));
+        _mm_store_ps(c + 7*stride + k, _mm_add_ps(_mm_add_ps(y, cw), dh));
+    }
 
-void g2dSetAlphaRelative(int alpha)
-{
-    g2dSetAlpha(rctx.cur_obj.alpha + alpha);
+    _g2dCornersC(i, n-k, c+k, stride);
 }
+#elif defined(__ARM_NEON)
+void _g2dCornersSimd(unsigned int i, unsigned int n,
+                     float *c, unsigned int stride)
+{
+    float32x4_t x, y, w, h, aw, cw, bh, dh;
+    unsigned int k;
 
-/* Rotation functions */
+    // Four objects at a time.
+    for (k=0; k+4<=n; k+=4, i+=4)
+    {
+        x = vld1q_f32(objs.x + i);
+        y = vld1q_f32(objs.y + i);
+        w = vld1q_f32(objs.w + i);
+        h = vld1q_f32(objs.h + i);
+        aw = vmulq_f32(vld1q_f32(objs.m00 + i), w);
+        cw = vmulq_f32(vld1q_f32(objs.m10 + i), w);
+        bh = vmulq_f32(vld1q_f32(objs.m01 + i), h);
+        dh = vmulq_f32(vld1q_f32(objs.m11 + i), h);
+
+        vst1q_f32(c + k, x);
+        vst1q_f32(c + stride + k, vaddq_f32(x, aw));
+        vst1q_f32(c + 2*stride + k, vaddq_f32(x, bh));
+        vst1q_f32(c + 3*stride + k, vaddq_f32(vaddq_f32(x, aw), bh));
+        vst1q_f32(c + 4*stride + k, y);
+        vst1q_f32(c + 5*stride + k, vaddq_f32(y, cw));
+        vst1q_f32(c + 6*stride + k, vaddq_f32(y, dh));
+        vst1q_f32(c + 7*stride + k, vaddq_f32(vaddq_f32(y, cw), dh));
+    }
 
-void g2dResetRotation()
-{
-    rctx.cur_obj.rot = 0.f;
-    rctx.cur_obj.rot_sin = 0.f;
-    rctx.cur_obj.rot_cos = 1.f;
+    _g2dCornersC(i, n-k, c+k, stride);
 }
+#endif
 
 
-void g2dGetRotationRad(float *radians)
+bool _g2dCornersReserve(unsigned int n)
 {
-    if (radians != NULL)
-        *radians = rctx.cur_obj.rot;
-}
+    unsigned int size = 8 * ((n + 3) & ~3);
+    float *c;
 
+    if (size <= corners_size)
+        return true;
 
-void g2dGetRotation(float *degrees)
-{
-    if (degrees != NULL)
-        *degrees = rctx.cur_obj.rot * M_180_PI;
+    if ((c = memalign(16, size * sizeof(float))) == NULL)
+        return false;
+
+    free(corners);
+    corners = c;
+    corners_size = size;
+
+    return true;
 }
 
 
-void g2dSetRotationRad(float radians)
+// The room must have been reserved, before the vertices are allocated.
+float* _g2dCorners(unsigned int i, unsigned int n, unsigned int *stride)
 {
-    if (radians == rctx.cur_obj.rot)
-        return;
-
-    rctx.cur_obj.rot = radians;
+    // Planes are kept aligned for the vector stores.
+    *stride = (n + 3) & ~3;
 
-#ifdef USE_VFPU
-    vfpu_sincosf(radians, &rctx.cur_obj.rot_sin, &rctx.cur_obj.rot_cos);
+#ifdef SIMD_CORNERS
+    _g2dCornersSimd(i, n, corners, *stride);
 #else
-    sincosf(radians, &rctx.cur_obj.rot_sin, &rctx.cur_obj.rot_cos);
+    _g2dCornersC(i, n, corners, *stride);
 #endif
 
-    if (radians != 0.f)
-        rctx.use_rot = true;
+    return corners;
 }
 
+/* Vertex emitters */
 
-void g2dSetRotation(float degrees)
-{
-    g2dSetRotationRad(degrees * M_PI_180);
-}
-
+// One function per vertex format, the format tests are resolved at compile
+// time. Vertex order: [texture uv] [color] [coord]
 
-void g2dSetRotationRadRelative(float radians)
+static INLINE void* _g2dEmitVertex(void *vp, unsigned int i,
+                                   float u, float v, float x, float y, int f)
 {
-    g2dSetRotationRad(rctx.cur_obj.rot + radians);
-}
+    short *vp_short = (short*)vp;
+    g2dColor *vp_color;
+    float *vp_float;
 
+    if (f & V_TEX) // Rounded, u & v being texel fractions
+    {
+        *(vp_short++) = objs.crop_x[i] + (int)(u * objs.crop_w[i] + 0.5f);
+        *(vp_short++) = objs.crop_y[i] + (int)(v * objs.crop_h[i] + 0.5f);
+    }
 
-void g2dSetRotationRelative(float degrees)
-{
-    g2dSetRotationRadRelative(degrees * M_PI_180);
-}
+    vp_color = (g2dColor*)vp_short;
 
-/* Crop functions */
+    if (f & V_COLOR)
+    {
+        *(vp_color++) = objs.color[i];
+    }
 
-void g2dResetCrop()
-{
-    if (rctx.tex == NULL)
-        return;
+    if (f & V_INT) // Pixel perfect
+    {
+        x = floorf(x);
+        y = floorf(y);
+    }
 
-    rctx.cur_obj.crop_x = 0;
-    rctx.cur_obj.crop_y = 0;
-    rctx.cur_obj.crop_w = rctx.tex->w;
-    rctx.cur_obj.crop_h = rctx.tex->h;
-}
+    if (f & V_SHORT) // Compact coordinates, see _g2dCanCompact()
+    {
+        vp_short = (short*)vp_color;
+        vp_short[0] = x;
+        vp_short[1] = y;
+        ((unsigned short*)vp_short)[2] = objs.z[i];
 
+        // A vertex is aligned on its largest component.
+        return (void*)(vp_short + (f & V_COLOR ? 4 : 3));
+    }
 
-void g2dGetCropXY(int *x, int *y)
-{
-    if (rctx.tex == NULL)
-        return;
+    vp_float = (float*)vp_color;
+    vp_float[0] = x;
+    vp_float[1] = y;
+    vp_float[2] = objs.z[i];
 
-    if (x != NULL) *x = rctx.cur_obj.crop_x;
-    if (y != NULL) *y = rctx.cur_obj.crop_y;
+    return (void*)(vp_float + 3);
 }
 
 
-void g2dGetCropWH(int *w, int *h)
+static INLINE void _g2dCorner(unsigned int i, float u, float v,
+                              float *x, float *y)
 {
-    if (rctx.tex == NULL)
-        return;
-
-    if (w != NULL) *w = rctx.cur_obj.crop_w;
-    if (h != NULL) *h = rctx.cur_obj.crop_h;
+    *x = objs.x[i] + u * objs.w[i];
+    *y = objs.y[i] + v * objs.h[i];
 }
 
 
-void g2dSetCropXY(int x, int y)
+static INLINE float _g2dLerp(float a, float b, float t)
 {
-    if (rctx.tex == NULL)
-        return;
-
-    rctx.cur_obj.crop_x = x;
-    rctx.cur_obj.crop_y = y;
+    // Exact at both ends, so that strips share their edges.
+    return a * (1.f-t) + b * t;
 }
 
 
-void g2dSetCropWH(int w, int h)
+static INLINE void* _g2dEmitStrips(void *vp, unsigned int i, const float *c,
+                                   unsigned int stride, int f)
 {
-    if (rctx.tex == NULL)
-        return;
+    float u, u_end;
+    int t, sw = _g2dObjSliceWidth(i);
 
-    rctx.cur_obj.crop_w = w;
-    rctx.cur_obj.crop_h = h;
+    // Quads along the top (c0 c1) & bottom (c2 c3) edges, one per slice.
+    for (t=0; t<objs.crop_w[i]; t+=sw)
+    {
+        u = (float)t / objs.crop_w[i];
+        u_end = (t+sw < objs.crop_w[i] ? (float)(t+sw)/objs.crop_w[i] : 1.f);
+
+        vp = _g2dEmitVertex(vp, i, u, 0.f,
+                            _g2dLerp(c[0], c[stride], u),
+                            _g2dLerp(c[4*stride], c[5*stride], u), f);
+        vp = _g2dEmitVertex(vp, i, u_end, 0.f,
+                            _g2dLerp(c[0], c[stride], u_end),
+                            _g2dLerp(c[4*stride], c[5*stride], u_end), f);
+        vp = _g2dEmitVertex(vp, i, u, 1.f,
+                            _g2dLerp(c[2*stride], c[3*stride], u),
+                            _g2dLerp(c[6*stride], c[7*stride], u), f);
+        vp = _g2dEmitVertex(vp, i, u_end, 1.f,
+                            _g2dLerp(c[2*stride], c[3*stride], u_end),
+                            _g2dLerp(c[6*stride], c[7*stride], u_end), f);
+        STATS_ADD(slices, 1);
+    }
+
+    return vp;
 }
 
 
-void g2dSetCropXYRelative(int x, int y)
+static INLINE void* _g2dEmitRects(void *vp, unsigned int i,
+                                  unsigned int n, int f)
 {
-    if (rctx.tex == NULL)
-        return;
+    float x[2], y[2];
+    float u, u_end;
+    float *c;
+    unsigned int k, stride;
+    int t, sw;
 
-    g2dSetCropXY(rctx.cur_obj.crop_x + x, rctx.cur_obj.crop_y + y);
-}
+    if (f & V_ROT) // Indexed quads, one per object or per slice
+    {
+        // The corners of all the objects are transformed at once.
+        c = _g2dCorners(i, n, &stride);
 
+        for (k=0; k<n; k++, i++)
+        {
+            if (f & V_TEX) // Strips, like the sprites below
+            {
+                vp = _g2dEmitStrips(vp, i, c + k, stride, f);
+                continue;
+            }
 
-void g2dSetCropWHRelative(int w, int h)
-{
-    if (rctx.tex == NULL)
-        return;
+            vp = _g2dEmitVertex(vp, i, 0.f, 0.f, c[k], c[4*stride+k], f);
+            vp = _g2dEmitVertex(vp, i, 1.f, 0.f,
+                                c[stride+k], c[5*stride+k], f);
+            vp = _g2dEmitVertex(vp, i, 0.f, 1.f,
+                                c[2*stride+k], c[6*stride+k], f);
+            vp = _g2dEmitVertex(vp, i, 1.f, 1.f,
+                                c[3*stride+k], c[7*stride+k], f);
+        }
 
-    g2dSetCropWH(rctx.cur_obj.crop_w + w, rctx.cur_obj.crop_h + h);
-}
+        return vp;
+    }
 
-/* Texture functions */
+    for (n+=i; i<n; i++)
+    {
+        if (!(f & V_TEX)) // One sprite per object
+        {
+            _g2dCorner(i, 0.f, 0.f, &x[0], &y[0]);
+            _g2dCorner(i, 1.f, 1.f, &x[1], &y[1]);
 
-void g2dResetTex()
-{
-    if (rctx.tex == NULL)
-        return;
+            vp = _g2dEmitVertex(vp, i, 0.f, 0.f, x[0], y[0], f);
+            vp = _g2dEmitVertex(vp, i, 1.f, 1.f, x[1], y[1], f);
+        }
+        else // Several sprites per object for a better texture cache use
+        {
+            sw = _g2dObjSliceWidth(i);
 
-    rctx.use_tex_repeat = false;
-    rctx.use_tex_linear = true;
-}
+            for (t=0; t<objs.crop_w[i]; t+=sw)
+            {
+                u = (float)t / objs.crop_w[i];
+                u_end = (t+sw < objs.crop_w[i] ?
+                         (float)(t+sw) / objs.crop_w[i] : 1.f);
 
+                _g2dCorner(i, u, 0.f, &x[0], &y[0]);
+                _g2dCorner(i, u_end, 1.f, &x[1], &y[1]);
 
-void g2dSetTexRepeat(bool use)
-{
-    if (rctx.tex == NULL)
-        return;
+                vp = _g2dEmitVertex(vp, i, u, 0.f, x[0], y[0], f);
+                vp = _g2dEmitVertex(vp, i, u_end, 1.f, x[1], y[1], f);
+                STATS_ADD(slices, 1);
+            }
+        }
+    }
 
-    rctx.use_tex_repeat = use;
+    return vp;
 }
 
 
-void g2dSetTexLinear(bool use)
+static INLINE void* _g2dEmitQuads(void *vp, unsigned int i,
+                                  unsigned int n, int f)
 {
-    if (rctx.tex == NULL)
-        return;
+    // One indexed quad per 4 objects, given clockwise.
+    for (n+=i; i+3<n; i+=4)
+    {
+        vp = _g2dEmitVertex(vp, i  , 0.f, 0.f, objs.x[i  ], objs.y[i  ], f);
+        vp = _g2dEmitVertex(vp, i+1, 1.f, 0.f, objs.x[i+1], objs.y[i+1], f);
+        vp = _g2dEmitVertex(vp, i+3, 0.f, 1.f, objs.x[i+3], objs.y[i+3], f);
+        vp = _g2dEmitVertex(vp, i+2, 1.f, 1.f, objs.x[i+2], objs.y[i+2], f);
+    }
 
-    rctx.use_tex_linear = use;
+    return vp;
 }
 
-/* Texture management */
 
-unsigned int _getNextPower2(unsigned int n)
+static INLINE void* _g2dEmitVertices(void *vp, unsigned int i,
+                                     unsigned int n, int f)
 {
-    n--;
-    n |= n >> 1;
-    n |= n >> 2;
-    n |= n >> 4;
-    n |= n >> 8;
-    n |= n >> 16;
+    // One vertex per object
+    for (n+=i; i<n; i++)
+    {
+        vp = _g2dEmitVertex(vp, i, 0.f, 0.f, objs.x[i], objs.y[i], f);
+    }
 
-    return n+1;
+    return vp;
 }
 
 
-void _swizzle(unsigned char *dest, unsigned char *source, int width, int height)
+static INLINE void* _g2dEmitMesh(void *vp, unsigned int i,
+                                 unsigned int n, int f)
 {
-    int i, j;
-    int rowblocks = (width / 16);
-    int rowblocks_add = (rowblocks-1) * 128;
-    unsigned int block_address = 0;
-    unsigned int *img = (unsigned int*)source;
+    int col = 0, row = 0;
 
-    for (j=0; j<height; j++)
+    // One vertex per object, mapped to the texture at its place in the grid.
+    for (n+=i; i<n; i++)
     {
-        unsigned int *block = (unsigned int*)(dest + block_address);
+        vp = _g2dEmitVertex(vp, i, (float)col/rctx.mesh_cols,
+                            (float)row/rctx.mesh_rows,
+                            objs.x[i], objs.y[i], f);
 
-        for (i = 0; i < rowblocks; i++)
+        if (++col > rctx.mesh_cols)
         {
-            *block++ = *img++;
-            *block++ = *img++;
-            *block++ = *img++;
-            *block++ = *img++;
-
-            block += 28;
+            col = 0;
+            row++;
         }
-
-        if ((j & 0x7) == 0x7)
-            block_address += rowblocks_add;
-
-        block_address += 16;
     }
+
+    return vp;
 }
 
 
-g2dTexture*g2dTexCreate(int w, int h)
+#define EMITTER(kind, f) \
+    void* _g2d##kind##f(void *vp, unsigned int i, unsigned int n) \
+    { return _g2dEmit##kind(vp, i, n, f); }
+
+EMITTER(Rects, 0)  EMITTER(Rects, 1)  EMITTER(Rects, 2)  EMITTER(Rects, 3)
+EMITTER(Rects, 4)  EMITTER(Rects, 5)  EMITTER(Rects, 6)  EMITTER(Rects, 7)
+EMITTER(Rects, 8)  EMITTER(Rects, 9)  EMITTER(Rects, 10) EMITTER(Rects, 11)
+EMITTER(Rects, 12) EMITTER(Rects, 13) EMITTER(Rects, 14) EMITTER(Rects, 15)
+EMITTER(Rects, 24) EMITTER(Rects, 25) EMITTER(Rects, 26) EMITTER(Rects, 27)
+EMITTER(Rects, 28) EMITTER(Rects, 29) EMITTER(Rects, 30) EMITTER(Rects, 31)
+
+EMITTER(Quads, 0)  EMITTER(Quads, 1)  EMITTER(Quads, 2)  EMITTER(Quads, 3)
+EMITTER(Quads, 8)  EMITTER(Quads, 9)  EMITTER(Quads, 10) EMITTER(Quads, 11)
+EMITTER(Quads, 24) EMITTER(Quads, 25) EMITTER(Quads, 26) EMITTER(Quads, 27)
+
+EMITTER(Vertices, 0)  EMITTER(Vertices, 2)
+EMITTER(Vertices, 8)  EMITTER(Vertices, 10)
+EMITTER(Vertices, 24) EMITTER(Vertices, 26)
+
+EMITTER(Mesh, 0)  EMITTER(Mesh, 1)  EMITTER(Mesh, 2)  EMITTER(Mesh, 3)
+EMITTER(Mesh, 8)  EMITTER(Mesh, 9)  EMITTER(Mesh, 10) EMITTER(Mesh, 11)
+EMITTER(Mesh, 24) EMITTER(Mesh, 25) EMITTER(Mesh, 26) EMITTER(Mesh, 27)
+
+static Emitter rect_emitters[V_FLAGS_NBR] =
+{
+    _g2dRects0,  _g2dRects1,  _g2dRects2,  _g2dRects3,
+    _g2dRects4,  _g2dRects5,  _g2dRects6,  _g2dRects7,
+    _g2dRects8,  _g2dRects9,  _g2dRects10, _g2dRects11,
+    _g2dRects12, _g2dRects13, _g2dRects14, _g2dRects15,
+    // Compact coordinates are always integer ones.
+    [V_SHORT|V_INT] = _g2dRects24, _g2dRects25, _g2dRects26, _g2dRects27,
+    _g2dRects28, _g2dRects29, _g2dRects30, _g2dRects31
+};
+
+// Quads can't be rotated, lines & points neither textured.
+static Emitter quad_emitters[V_FLAGS_NBR] =
+{
+    [0] = _g2dQuads0,  [V_TEX] = _g2dQuads1,
+    [V_COLOR] = _g2dQuads2,  [V_COLOR|V_TEX] = _g2dQuads3,
+    [V_INT] = _g2dQuads8,  [V_INT|V_TEX] = _g2dQuads9,
+    [V_INT|V_COLOR] = _g2dQuads10,  [V_INT|V_COLOR|V_TEX] = _g2dQuads11,
+    [V_SHORT|V_INT] = _g2dQuads24,  [V_SHORT|V_INT|V_TEX] = _g2dQuads25,
+    [V_SHORT|V_INT|V_COLOR] = _g2dQuads26,
+    [V_SHORT|V_INT|V_COLOR|V_TEX] = _g2dQuads27
+};
+
+static Emitter vertex_emitters[V_FLAGS_NBR] =
+{
+    [0] = _g2dVertices0,  [V_COLOR] = _g2dVertices2,
+    [V_INT] = _g2dVertices8,  [V_INT|V_COLOR] = _g2dVertices10,
+    [V_SHORT|V_INT] = _g2dVertices24,  [V_SHORT|V_INT|V_COLOR] = _g2dVertices26
+};
+
+static Emitter mesh_emitters[V_FLAGS_NBR] =
+{
+    [0] = _g2dMesh0,  [V_TEX] = _g2dMesh1,
+    [V_COLOR] = _g2dMesh2,  [V_COLOR|V_TEX] = _g2dMesh3,
+    [V_INT] = _g2dMesh8,  [V_INT|V_TEX] = _g2dMesh9,
+    [V_INT|V_COLOR] = _g2dMesh10,  [V_INT|V_COLOR|V_TEX] = _g2dMesh11,
+    [V_SHORT|V_INT] = _g2dMesh24,  [V_SHORT|V_INT|V_TEX] = _g2dMesh25,
+    [V_SHORT|V_INT|V_COLOR] = _g2dMesh26,
+    [V_SHORT|V_INT|V_COLOR|V_TEX] = _g2dMesh27
+};
+
+
+bool _g2dCanCompact(unsigned int i, unsigned int n)
+{
+    float x0, y0, x1, y1;
+
+    // Every vertex must fit in a short, and depth in an unsigned one.
+    for (n+=i; i<n; i++)
+    {
+        if (objs.z[i] < 0.f || objs.z[i] > USHRT_MAX ||
+            objs.z[i] != (int)objs.z[i])
+            return false;
+
+        x0 = x1 = objs.x[i];
+        y0 = y1 = objs.y[i];
+
+        if (rctx.type == RECTS && rctx.use_rot) // Bounding box
+        {
+            x0 += fminf(objs.m00[i]*objs.w[i], 0.f) +
+                  fminf(objs.m01[i]*objs.h[i], 0.f);
+            x1 += fmaxf(objs.m00[i]*objs.w[i], 0.f) +
+                  fmaxf(objs.m01[i]*objs.h[i], 0.f);
+            y0 += fminf(objs.m10[i]*objs.w[i], 0.f) +
+                  fminf(objs.m11[i]*objs.h[i], 0.f);
+            y1 += fmaxf(objs.m10[i]*objs.w[i], 0.f) +
+                  fmaxf(objs.m11[i]*objs.h[i], 0.f);
+        }
+        else if (rctx.type == RECTS)
+        {
+            x1 += objs.w[i];
+            y1 += objs.h[i];
+        }
+
+        if (x0 < SHRT_MIN || y0 < SHRT_MIN || x1 > SHRT_MAX || y1 > SHRT_MAX)
+            return false;
+    }
+
+    return true;
+}
+
+
+int _g2dVertexFlags(unsigned int i, unsigned int n)
+{
+    int f = (rctx.tex != NULL ? V_TEX : 0) |
+            (rctx.use_vert_color ? V_COLOR : 0) |
+            (rctx.use_rot ? V_ROT : 0) |
+            (rctx.use_int ? V_INT : 0);
+
+    // Pixel-aligned batches can halve their vertex size.
+    if (rctx.use_int && rctx.use_compact && _g2dCanCompact(i, n))
+        f |= V_SHORT;
+
+    return f;
+}
+
+
+int _g2dVertexType(int f, int *size)
+{
+    int type = GU_TRANSFORM_2D;
+
+    *size = 0;
+
+    if (f & V_TEX)
+    {
+        type |= GU_TEXTURE_16BIT;
+        *size += 2 * sizeof(short);
+    }
+
+    if (f & V_COLOR)
+    {
+        type |= GU_COLOR_8888;
+        *size += sizeof(g2dColor);
+    }
+
+    if (f & V_SHORT)
+    {
+        type |= GU_VERTEX_16BIT;
+        *size += (f & V_COLOR ? 4 : 3) * sizeof(short);
+    }
+    else
+    {
+        type |= GU_VERTEX_32BITF;
+        *size += 3 * sizeof(float);
+    }
+
+    return type;
+}
+
+
+#ifdef USE_VFPU
+void vfpu_sincosf(float x, float *s, float *c)
+{
+    __asm__ volatile (
+        "mtv    %2, s000\n"           // s000 = x
+        "vcst.s s001, VFPU_2_PI\n"    // s001 = 2/pi
+        "vmul.s s000, s000, s001\n"   // s000 = s000*s001
+        "vrot.p c010, s000, [s, c]\n" // s010 = sinf(s000), s011 = cosf(s000)
+        "mfv    %0, s010\n"           // *s = s010
+        "mfv    %1, S011\n"           // *c = s011
+        : "=r"(*s), "=r"(*c) : "r"(x)
+    );
+}
+#endif
+
+
+void _g2dFastSinCos(float x, float *s, float *c)
+{
+    union { float f; unsigned int i; } ps, pc;
+    float r, z, qf;
+    unsigned int q, swap, si, ci;
+
+    // The bound is only kept by the range reduction below.
+    if (x > 8192.f || x < -8192.f)
+    {
+        sincosf(x, s, c);
+        return;
+    }
+
+    // Nearest quadrant (adding 1.5*2^23 rounds), then x - q*pi/2 in three
+    // steps to keep the precision.
+    qf = (x * 0.63661977f + 12582912.f) - 12582912.f;
+    q = (int)qf;
+    r = ((x - qf*1.5703125f) - qf*4.837512969970703e-4f) -
+        qf*7.549789954891882e-8f;
+    z = r * r;
+
+    // Minimax polynomials on [-pi/4, pi/4] (Cephes).
+    ps.f = ((-1.9515295891e-4f*z + 8.3321608736e-3f)*z - 1.6666654611e-1f)*z*r + r;
+    pc.f = ((2.4433157118e-5f*z - 1.3887316255e-3f)*z + 4.1666645683e-2f)*z*z -
+           0.5f*z + 1.f;
+
+    // Quadrant fix-up on the bits, random angles would defeat branches:
+    // odd quadrants swap sine and cosine, then the signs flip.
+    swap = -(q & 1);
+    si = ps.i;
+    ci = pc.i;
+    ps.i = ((si & ~swap) | (ci & swap)) ^ ((q & 2) << 30);
+    pc.i = ((ci & ~swap) | (si & swap)) ^ (((q + 1) & 2) << 30);
+
+    *s = ps.f;
+    *c = pc.f;
+}
+
+
+void _g2dSinCos(float x, float *s, float *c)
+{
+#if defined(USE_VFPU)
+    vfpu_sincosf(x, s, c);
+#elif defined(USE_FAST_SINCOS)
+    _g2dFastSinCos(x, s, c);
+#else
+    sincosf(x, s, c);
+#endif
+}
+
+/* Main functions */
+
+void g2dInit()
+{
+    if (init)
+        return;
+
+    // Display list allocation
+    dlist = &dlists[0];
+    dlist->n = 0;
+    if (_g2dGetSegment(dlist, DLIST_SIZE) == NULL)
+        return;
+
+    _g2dQuadIndices();
+
+    // Setup GU
+    sceGuInit();
+    sceGuStart(GU_DIRECT, dlist->seg[0].data);
+
+    sceGuDrawBuffer(GU_PSM_8888, g2d_draw_buffer.data, LINE_SIZE);
+    sceGuDispBuffer(G2D_SCR_W, G2D_SCR_H, g2d_disp_buffer.data, LINE_SIZE);
+    sceGuDepthBuffer((void*)(FRAMEBUFFER_SIZE*2), LINE_SIZE);
+    sceGuOffset(2048-G2D_SCR_W/2, 2048-G2D_SCR_H/2);
+    sceGuViewport(2048, 2048, G2D_SCR_W, G2D_SCR_H);
+    
+    g2d_draw_buffer.data = vabsptr(g2d_draw_buffer.data);
+    g2d_disp_buffer.data = vabsptr(g2d_disp_buffer.data);
+
+    sceGuDepthRange(65535, 0);
+    sceGuClearDepth(65535);
+    sceGuAlphaFunc(GU_GREATER, 0, 255);
+    sceGuDepthFunc(GU_LEQUAL);
+    sceGuBlendFunc(GU_ADD, GU_SRC_ALPHA, GU_ONE_MINUS_SRC_ALPHA, 0, 0);
+    sceGuTexFunc(GU_TFX_MODULATE, GU_TCC_RGBA);
+    sceGuTexFilter(GU_LINEAR, GU_LINEAR);
+    sceGuShadeModel(GU_SMOOTH);
+
+    sceGuDisable(GU_CULL_FACE);
+    sceGuDisable(GU_CLIP_PLANES);
+    sceGuDisable(GU_DITHER);
+    sceGuEnable(GU_ALPHA_TEST);
+    sceGuEnable(GU_SCISSOR_TEST);
+    sceGuEnable(GU_BLEND);
+
+    g2dResetGlobalScale();
+    g2dResetScissor();
+    g2dResetMatrix();
+
+    sceGuFinish();
+    sceGuSync(0, 0);
+    sceDisplayWaitVblankStart();
+    sceGuDisplay(GU_TRUE);
+
+    init = true;
+}
+
+
+void g2dTerm()
+{
+    unsigned int i, j;
+
+    if (!init)
+        return;
+ 
+    if (in_flight)
+        sceGuSync(GU_SYNC_SEND, GU_SYNC_WAIT);
+
+    sceGuTerm();
+
+    for (i=0; i<DLIST_NBR; i++)
+    {
+        for (j=0; j<dlists[i].seg_nbr; j++)
+            free(dlists[i].seg[j].data);
+
+        free(dlists[i].seg);
+        memset(&dlists[i], 0, sizeof(Dlist));
+    }
+
+    dlist = NULL;
+    dlist_i = 0;
+    dlist_peak = 0;
+    in_flight = false;
+
+    free(objs.data);
+    memset(&objs, 0, sizeof(ObjStore));
+
+    free(corners);
+    corners = NULL;
+    corners_size = 0;
+
+    free(tstack);
+    tstack = NULL;
+    tstack_size = 0;
+    tstack_cap = 0;
+
+    free(mat_runs);
+    mat_runs = NULL;
+    mat_run_size = 0;
+
+    free(vram_ents);
+    vram_ents = NULL;
+    vram_n = 0;
+    vram_size = 0;
+    vram_bytes = 0;
+    
+    init = false;
+}
+
+void g2dClear(g2dColor color)
+{
+    if (!start && batch == NULL && !_g2dStart())
+        return;
+
+    _g2dFlush();
+    if (!_g2dReserve(0))
+        return;
+
+    sceGuClearColor(color);
+    sceGuClear(GU_COLOR_BUFFER_BIT |
+               GU_FAST_CLEAR_BIT |
+               (zclear ? GU_DEPTH_BUFFER_BIT : 0));
+
+    zclear = false;
+}
+
+
+void g2dClearZ()
+{
+    if (!start && batch == NULL && !_g2dStart())
+        return;
+
+    _g2dFlush();
+    if (!_g2dReserve(0))
+        return;
+
+    sceGuClear(GU_DEPTH_BUFFER_BIT | GU_FAST_CLEAR_BIT);
+    zclear = true;
+}
+
+
+void _g2dBeginCommon(Obj_Type type, g2dTexture *tex)
+{
+    if (begin)
+        return;
+
+    if (!start && batch == NULL && !_g2dStart())
+        return;
+
+    // Reset render context, the store is reused when nothing is pending.
+    if (pending.n == 0)
+        objs.n = 0;
+
+    rctx.first = objs.n;
+    rctx.n = 0;
+    rctx.rot_n = 0;
+    mat_run_n = 0;
+    mat_dirty = true;
+    rctx.type = type;
+    rctx.tex = tex;
+    rctx.use_strip = false;
+    rctx.use_z = false;
+    rctx.use_vert_color = false;
+    rctx.use_rot = false;
+    rctx.use_tex_linear = true;
+    rctx.use_tex_repeat = false;
+    rctx.use_int = false;
+    rctx.use_compact = true;
+    rctx.color_count = 0;
+    rctx.coord_mode = DEFAULT_COORD_MODE;
+    
+    // Reset current object
+    g2dReset();
+
+    begin = true;
+}
+
+
+void g2dBeginRects(g2dTexture *tex)
+{
+    _g2dBeginCommon(RECTS, tex);
+}
+
+
+void g2dBeginLines(g2dLine_Mode mode)
+{
+    _g2dBeginCommon(LINES, NULL);
+    
+    rctx.use_strip = (mode & G2D_STRIP);
+}
+
+
+void g2dBeginQuads(g2dTexture *tex)
+{
+    _g2dBeginCommon(QUADS, tex);
+}
+
+
+void g2dBeginPoints()
+{
+    _g2dBeginCommon(POINTS, NULL);
+}
+
+
+void g2dBeginMesh(g2dTexture *tex, int cols, int rows)
+{
+    // Vertices are indexed with shorts.
+    if (cols < 1 || rows < 1 || (cols+1)*(rows+1) > 65536)
+        return;
+
+    _g2dBeginCommon(MESH, tex);
+
+    rctx.mesh_cols = cols;
+    rctx.mesh_rows = rows;
+}
+
+
+void _g2dDrawArray(int prim, int type, int nbr, const void *idx,
+                   int v_nbr, int size, void *v)
+{
+    BatchDraw *draw;
+
+    // Keep what is needed to draw it again somewhere else. Without room,
+    // the draw is dropped from both the call list and the copies.
+    if (batch != NULL && batch->n % MALLOC_STEP == 0)
+    {
+        draw = realloc(batch->draw, (batch->n+MALLOC_STEP) * sizeof(BatchDraw));
+        if (draw == NULL)
+            return;
+
+        batch->draw = draw;
+    }
+
+    sceGuDrawArray(prim, type, nbr, idx, v);
+
+    if (batch == NULL)
+    {
+        STATS_ADD(draw_calls, 1);
+        STATS_ADD(vertices, v_nbr);
+
+        if ((type & GU_VERTEX_BITS) == GU_VERTEX_16BIT)
+            STATS_ADD(compact_batches, 1);
+
+        return;
+    }
+
+    draw = &batch->draw[batch->n++];
+    draw->tex = rctx.tex;
+    draw->color = rctx.cur_obj.color;
+    draw->use_z = rctx.use_z;
+    draw->use_vert_color = rctx.use_vert_color;
+    draw->use_tex_linear = rctx.use_tex_linear;
+    draw->use_tex_repeat = rctx.use_tex_repeat;
+    draw->prim = prim;
+    draw->type = type;
+    draw->nbr = nbr;
+    draw->size = size;
+    draw->idx = idx;
+    draw->v_nbr = v_nbr;
+    draw->v = v;
+
+    batch->v_nbr += v_nbr;
+
+    if (rctx.use_z)
+        batch->use_z = true;
+}
+
+
+void _g2dDrawQuads(int type, int nbr, int size, char *v)
+{
+    int n;
+
+    // The index buffer covers a limited number of quads, split if needed.
+    for (; nbr>0; nbr-=n, v+=4*n*size)
+    {
+        n = (nbr > INDEX_QUAD_NBR ? INDEX_QUAD_NBR : nbr);
+        _g2dDrawArray(GU_TRIANGLES, type | GU_INDEX_16BIT, 6*n, quad_idx,
+                      4*n, size, v);
+    }
+}
+
+
+void _g2dEndRects()
+{
+    // Define vertices properties
+    int v_obj_nbr = (rctx.use_rot ? 4 : 2);
+    int v_nbr;
+    int v_flags = _g2dVertexFlags(rctx.first, rctx.n);
+    int v_size;
+    int v_type = _g2dVertexType(v_flags, &v_size);
+
+    // Count how many vertices to allocate.
+    if (rctx.tex == NULL) // No slicing
+    {
+        v_nbr = v_obj_nbr * rctx.n;
+    }
+    else // Can use texture slicing for tremendous performance :)
+    {
+        rctx.slice_w = _g2dSliceWidth(rctx.tex, rctx.use_rot);
+
+        // Slices out of the scissor are not generated.
+        if (!rctx.use_rot)
+            _g2dObjClip(rctx.first, rctx.n);
+
+        v_nbr = v_obj_nbr * _g2dSliceNbr(rctx.first, rctx.n);
+    }
+
+    if (rctx.use_rot && !_g2dCornersReserve(rctx.n))
+        return;
+
+    // Allocate vertex list memory
+    void *v = _g2dGetMemory(v_nbr * v_size);
+    if (v == NULL)
+        return;
+
+    // Build the vertex list
+    rect_emitters[v_flags](v, rctx.first, rctx.n);
+
+    // Then put it in the display list.
+    if (rctx.use_rot)
+        _g2dDrawQuads(v_type, v_nbr / 4, v_size, v);
+    else
+        _g2dDrawArray(GU_SPRITES, v_type, v_nbr, NULL, v_nbr, v_size, v);
+}
+
+
+void _g2dEndLines()
+{
+    // Define vertices properties
+    int v_prim = (rctx.use_strip ? GU_LINE_STRIP : GU_LINES);
+    int v_obj_nbr = (rctx.use_strip ? 1 : 2);
+    int v_nbr = v_obj_nbr * (rctx.use_strip ? rctx.n : rctx.n/2);
+    int v_flags = _g2dVertexFlags(rctx.first, v_nbr) & ~V_ROT;
+    int v_size;
+    int v_type = _g2dVertexType(v_flags, &v_size);
+
+    // Allocate vertex list memory
+    void *v = _g2dGetMemory(v_nbr * v_size);
+    if (v == NULL)
+        return;
+
+    // Build the vertex list, one vertex per object.
+    vertex_emitters[v_flags](v, rctx.first, v_nbr);
+
+    // Then put it in the display list.
+    _g2dDrawArray(v_prim, v_type, v_nbr, NULL, v_nbr, v_size, v);
+}
+
+
+void _g2dEndQuads()
+{
+    // Define vertices properties
+    int v_obj_nbr = 4;
+    int v_nbr = v_obj_nbr * (rctx.n / 4);
+    int v_flags = _g2dVertexFlags(rctx.first, rctx.n) & ~V_ROT;
+    int v_size;
+    int v_type = _g2dVertexType(v_flags, &v_size);
+
+    // Allocate vertex list memory
+    void *v = _g2dGetMemory(v_nbr * v_size);
+    if (v == NULL)
+        return;
+
+    // Build the vertex list
+    quad_emitters[v_flags](v, rctx.first, rctx.n);
+
+    // Then put it in the display list.
+    _g2dDrawQuads(v_type, rctx.n / 4, v_size, v);
+}
+
+
+void _g2dEndMesh()
+{
+    // Define vertices properties, only complete rows are drawn.
+    int v_cols = rctx.mesh_cols + 1;
+    int v_rows = rctx.n / v_cols;
+    int v_nbr, i_nbr;
+    int v_flags, v_size, v_type;
+    unsigned short *idx;
+    int row, col;
+
+    if (v_rows > rctx.mesh_rows + 1)
+        v_rows = rctx.mesh_rows + 1;
+
+    if (v_rows < 2)
+        return;
+
+    // One strip per row of cells, joined by degenerate triangles.
+    v_nbr = v_cols * v_rows;
+    i_nbr = (v_rows-1) * (2*v_cols + 2) - 2;
+    v_flags = _g2dVertexFlags(rctx.first, v_nbr) & ~V_ROT;
+    v_type = _g2dVertexType(v_flags, &v_size);
+
+    // Allocate vertex & index list memory
+    void *v = _g2dGetMemory(v_nbr * v_size);
+    idx = _g2dGetMemory(i_nbr * sizeof(unsigned short));
+    if (v == NULL || idx == NULL)
+        return;
+
+    // Build the vertex list, then the strips.
+    mesh_emitters[v_flags](v, rctx.first, v_nbr);
+
+    for (row=0; row<v_rows-1; row++)
+    {
+        if (row > 0)
+            *(idx++) = row * v_cols;
+
+        for (col=0; col<v_cols; col++)
+        {
+            *(idx++) = row * v_cols + col;
+            *(idx++) = (row+1) * v_cols + col;
+        }
+
+        if (row < v_rows-2)
+            *(idx++) = (row+1) * v_cols + v_cols-1;
+    }
+
+    // Then put it in the display list.
+    _g2dDrawArray(GU_TRIANGLE_STRIP, v_type | GU_INDEX_16BIT, i_nbr,
+                  idx - i_nbr, v_nbr, v_size, v);
+}
+
+
+void _g2dEndPoints()
+{
+    // Define vertices properties
+    int v_prim = GU_POINTS;
+    int v_obj_nbr = 1;
+    int v_nbr = v_obj_nbr * rctx.n;
+    int v_flags = _g2dVertexFlags(rctx.first, rctx.n) & ~V_ROT;
+    int v_size;
+    int v_type = _g2dVertexType(v_flags, &v_size);
+
+    // Allocate vertex list memory
+    void *v = _g2dGetMemory(v_nbr * v_size);
+    if (v == NULL)
+        return;
+
+    // Build the vertex list
+    vertex_emitters[v_flags](v, rctx.first, rctx.n);
+
+    // Then put it in the display list.
+    _g2dDrawArray(v_prim, v_type, v_nbr, NULL, v_nbr, v_size, v);
+}
+
+
+void _g2dSubmit()
+{
+    if (!_g2dReserve(0))
+        return;
+
+    if (rctx.use_rot && rctx.rot_n < rctx.n)
+        _g2dObjFillRot();
+
+    // Manage pspgu extensions
+    _g2dSetGuState();
+
+    switch (rctx.type)
+    {
+        case RECTS:
+            _g2dEndRects();
+            break;
+
+        case LINES:
+            _g2dEndLines();
+            break;
+
+        case QUADS:
+            _g2dEndQuads();
+            break;
+
+        case POINTS:
+            _g2dEndPoints();
+            break;
+
+        case MESH:
+            _g2dEndMesh();
+            break;
+    }
+
+    _g2dRestoreColor();
+
+    if (rctx.use_z)
+        zclear = true;
+}
+
+
+void _g2dFlush()
+{
+    RenderContext tmp;
+
+    if (pending.n == 0)
+        return;
+
+    tmp = rctx;
+    rctx = pending;
+    _g2dSubmit();
+    rctx.n = 0;
+    pending = rctx;
+    rctx = tmp;
+}
+
+
+bool _g2dCanMerge()
+{
+    if (pending.n == 0 || pending.first + pending.n != rctx.first)
+        return false;
+
+    // Same primitive, vertex format & pspgu states.
+    if (pending.type != rctx.type ||
+        pending.tex != rctx.tex ||
+        pending.use_strip || rctx.use_strip ||
+        rctx.type == MESH ||
+        pending.use_z != rctx.use_z ||
+        pending.use_vert_color != rctx.use_vert_color ||
+        pending.use_rot != rctx.use_rot ||
+        pending.use_int != rctx.use_int ||
+        pending.use_compact != rctx.use_compact)
+        return false;
+
+    if (rctx.tex != NULL &&
+        (pending.use_tex_linear != rctx.use_tex_linear ||
+         pending.use_tex_repeat != rctx.use_tex_repeat))
+        return false;
+
+    if (!rctx.use_vert_color && pending.cur_obj.color != rctx.cur_obj.color)
+        return false;
+
+    // Don't mix up incomplete lines & quads.
+    if ((rctx.type == LINES && pending.n % 2 != 0) ||
+        (rctx.type == QUADS && pending.n % 4 != 0))
+        return false;
+
+    return true;
+}
+
+
+void g2dEnd()
+{
+    RenderContext tmp;
+
+    if (!begin || rctx.n == 0)
+    {
+        begin = false;
+        return;
+    }
+
+    _g2dObjPrepare();
+
+    if (!deferred)
+    {
+        _g2dSubmit();
+    }
+    else if (_g2dCanMerge())
+    {
+        // The objects directly follow the pending ones in the store.
+        pending.n += rctx.n;
+        pending.rot_n = pending.n;
+    }
+    else
+    {
+        // Submit the pending batch, this one becomes the pending one. It is
+        // moved to the store start, which is only used by pending batches.
+        _g2dFlush();
+        _g2dObjMoveFirst(rctx.first, rctx.n);
+        rctx.first = 0;
+
+        tmp = pending;
+        pending = rctx;
+        rctx = tmp;
+    }
+
+    begin = false;
+}
+
+
+void g2dSetDeferred(bool use)
+{
+    if (!use)
+        _g2dFlush();
+
+    deferred = use;
+}
+
+
+void g2dInvalidateState()
+{
+    _g2dFlush();
+
+    gu_state.valid = false;
+    gu_state.tex_valid = false;
+}
+
+
+void g2dReset()
+{
+    g2dResetCoord();
+    g2dResetScale();
+    g2dResetColor();
+    g2dResetAlpha();
+    g2dResetRotation();
+    g2dResetCrop();
+    g2dResetTex();
+}
+
+
+void _g2dSwapBuffers(g2dFlip_Mode mode)
+{
+    if (mode & G2D_VSYNC)
+        sceDisplayWaitVblankStart();
+
+    g2d_disp_buffer.data = g2d_draw_buffer.data;
+    g2d_draw_buffer.data = vabsptr(sceGuSwapBuffers());
+}
+
+
+void _g2dShowInFlight(g2dFlip_Mode mode)
+{
+    if (!in_flight)
+        return;
+
+    // Sync with the list only when its frame has to be displayed.
+    sceGuSync(GU_SYNC_SEND, GU_SYNC_WAIT);
+    in_flight = false;
+
+    _g2dSwapBuffers(mode);
+}
+
+
+void g2dFlip(g2dFlip_Mode mode)
+{
+    unsigned int i;
+
+    _g2dFlush();
+
+    if (scissor)
+        g2dResetScissor();
+
+    g2dResetMatrix();
+
+    dlist_bytes += sceGuFinish();
+
+    if (dlist_bytes > dlist_peak)
+        dlist_peak = dlist_bytes;
+
+    _g2dVramEndFrame();
+
+#ifdef USE_STATS
+    cur_stats.dlist_bytes = dlist_bytes;
+    cur_stats.vram_bytes = vram_bytes;
+    last_stats = cur_stats;
+    memset(&cur_stats, 0, sizeof(g2dFrameStats));
+#endif
+
+    if (!frame_async)
+    {
+        sceGuSync(0, 0);
+        _g2dSwapBuffers(mode);
+    }
+    else
+    {
+        // Display the previous frame, then let the GE render this one
+        // while the next one is recorded in another list.
+        _g2dShowInFlight(mode);
+
+        for (i=0; i<dlist->n; i++)
+            sceGuSendList(GU_TAIL, dlist->seg[i].data, NULL);
+
+        in_flight = true;
+        dlist_i = (dlist_i + 1) % DLIST_NBR;
+
+        if (!async) // Back to synchronous mode.
+            _g2dShowInFlight(mode);
+    }
+
+    start = false;
+}
+
+
+void g2dSetAsyncFlip(bool use)
+{
+    async = use;
+}
+
+
+void g2dSetVramPool(bool use)
+{
+    vram_pool = use;
+
+    if (!use)
+    {
+        while (vram_n > 0)
+            _g2dVramRemove(vram_n-1);
+    }
+}
+
+
+unsigned int g2dGetDlistHighWater()
+{
+    return dlist_peak;
+}
+
+
+void g2dAdd()
+{
+    unsigned int i, g;
+
+    if (!begin || rctx.cur_obj.scale_w == 0.f || rctx.cur_obj.scale_h == 0.f)
+        return;
+
+    // Without room, the object is dropped.
+    i = rctx.first + rctx.n;
+    if (!_g2dObjReserve(i+1))
+        return;
+
+    if (mat_dirty && !_g2dMatRun(i))
+        return;
+
+    // Keep the rotation data contiguous.
+    if (rctx.use_rot && rctx.rot_n < rctx.n)
+        _g2dObjFillRot();
+
+    _g2dObjStore(i, &rctx.cur_obj);
+
+    rctx.n++;
+    objs.n = i+1;
+
+    if (rctx.use_rot)
+        rctx.rot_n = rctx.n;
+
+    STATS_ADD(objects, 1);
+
+    // Drop what is out of the scissor, once a group is complete.
+    g = _g2dCullGroup();
+
+    if (g > 0 && rctx.n % g == 0 && _g2dObjCulled(i+1-g, g))
+        _g2dObjCull(g);
+
+#ifdef USE_STATS
+    if (objs.size > cur_stats.obj_capacity)
+        cur_stats.obj_capacity = objs.size;
+#endif
+}
+
+
+void _g2dBulkObject(Object *obj, const g2dBulk *bulk, unsigned int i)
+{
+    // Same as setting the object properties, then g2dAdd().
+    obj->x = bulk->x[i] * global_scale;
+    obj->y = bulk->y[i] * global_scale;
+
+    if (bulk->z != NULL)
+        obj->z = bulk->z[i] * global_scale;
+
+    if (bulk->w != NULL)
+        obj->scale_w = bulk->w[i] * global_scale;
+    if (bulk->h != NULL)
+        obj->scale_h = bulk->h[i] * global_scale;
+
+    if (bulk->color != NULL)
+        obj->color = bulk->color[i];
+
+    if (rctx.tex != NULL && bulk->crop_x != NULL)
+    {
+        obj->crop_x = bulk->crop_x[i];
+        obj->crop_y = bulk->crop_y[i];
+        obj->crop_w = bulk->crop_w[i];
+        obj->crop_h = bulk->crop_h[i];
+    }
+
+    if (bulk->rot != NULL)
+    {
+        obj->rot = bulk->rot[i];
+        _g2dSinCos(obj->rot, &obj->rot_sin, &obj->rot_cos);
+    }
+}
+
+
+void _g2dAddBulk(Obj_Type type, const g2dBulk *bulk, unsigned int n)
+{
+    RenderContext tmp;
+    Object obj;
+    unsigned int first;
+    int v_prim, v_nbr, v_flags, v_size, v_type;
+    unsigned int i, k, g;
+
+    if (!begin || rctx.type != type || n == 0 ||
+        bulk == NULL || bulk->x == NULL || bulk->y == NULL)
+        return;
+
+    // Objects added before are drawn first.
+    _g2dFlush();
+
+    if (rctx.n > 0)
+    {
+        _g2dObjPrepare();
+        _g2dSubmit();
+        rctx.n = 0;
+    }
+
+    tmp = rctx;
+    obj = rctx.cur_obj;
+
+    if (!MAT_AXIS_ALIGNED(mat))
+        rctx.use_rot = true;
+
+    if (bulk->z != NULL)
+        rctx.use_z = true;
+
+    if (bulk->rot != NULL)
+        rctx.use_rot = true;
+
+    // Mirrored sprites are drawn as triangles, see g2dSetScaleWH().
+    for (i=0; i<n && !rctx.use_rot; i++)
+    {
+        if ((bulk->w != NULL && bulk->w[i] < 0.f) ||
+            (bulk->h != NULL && bulk->h[i] < 0.f))
+            rctx.use_rot = true;
+    }
+
+    if (bulk->color != NULL)
+        rctx.use_vert_color = true;
+
+    if (type != RECTS)
+        rctx.tex = NULL;
+
+    // The objects are only stored for the time of the draw, after the others.
+    first = objs.n;
+    if (!_g2dObjReserve(first + n))
+    {
+        rctx = tmp;
+        return;
+    }
+    g = _g2dCullGroup();
+
+    STATS_ADD(objects, n);
+
+    for (i=0, k=first; i<n; i++)
+    {
+        _g2dBulkObject(&obj, bulk, i);
+        _g2dObjStore(k++, &obj);
+
+        // Drop what is out of the scissor, see g2dAdd().
+        if (g > 0 && (k-first) % g == 0 && _g2dObjCulled(k-g, g))
+        {
+            k -= g;
+            STATS_ADD(culled, g);
+        }
+    }
+
+    n = k - first;
+
+    if (!_g2dMatIdentity(&mat))
+        _g2dObjTransform(&mat, first, n);
+
+    // Define vertices properties
+    if (type == RECTS)
+    {
+        v_prim = GU_SPRITES; // Rotated ones are indexed quads
+        v_nbr = (rctx.use_rot ? 4 : 2) * n;
+
+        if (rctx.tex != NULL) // Texture slicing
+        {
+            rctx.slice_w = _g2dSliceWidth(rctx.tex, rctx.use_rot);
+
+            if (!rctx.use_rot)
+                _g2dObjClip(first, n);
+
+            v_nbr = (rctx.use_rot ? 4 : 2) * _g2dSliceNbr(first, n);
+        }
+    }
+    else if (type == LINES)
+    {
+        v_prim = (rctx.use_strip ? GU_LINE_STRIP : GU_LINES);
+        v_nbr = (rctx.use_strip ? n : n & ~1);
+    }
+    else
+    {
+        v_prim = GU_POINTS;
+        v_nbr = n;
+    }
+
+    if (v_nbr == 0 ||
+        (type == RECTS && rctx.use_rot && !_g2dCornersReserve(n)))
+    {
+        rctx = tmp;
+        return;
+    }
+
+    v_flags = _g2dVertexFlags(first, n);
+    v_type = _g2dVertexType(v_flags, &v_size);
+
+    if (!_g2dReserve(0))
+    {
+        rctx = tmp;
+        return;
+    }
+
+    _g2dSetGuState();
+
+    // Write the vertices straight to the display list.
+    void *v = _g2dGetMemory(v_nbr * v_size);
+    if (v == NULL)
+    {
+        rctx = tmp;
+        return;
+    }
+
+    if (type == RECTS)
+        rect_emitters[v_flags](v, first, n);
+    else // A last line without its pair is dropped.
+        vertex_emitters[v_flags & ~V_ROT](v, first, v_nbr);
+
+    if (type == RECTS && rctx.use_rot)
+        _g2dDrawQuads(v_type, v_nbr / 4, v_size, v);
+    else
+        _g2dDrawArray(v_prim, v_type, v_nbr, NULL, v_nbr, v_size, v);
+
+    _g2dRestoreColor();
+
+    if (rctx.use_z)
+        zclear = true;
+
+    rctx = tmp;
+}
+
+
+void g2dAddRects(const g2dBulk *bulk, unsigned int n)
+{
+    _g2dAddBulk(RECTS, bulk, n);
+}
+
+
+void g2dAddLines(const g2dBulk *bulk, unsigned int n)
+{
+    _g2dAddBulk(LINES, bulk, n);
+}
+
+
+void g2dAddPoints(const g2dBulk *bulk, unsigned int n)
+{
+    _g2dAddBulk(POINTS, bulk, n);
+}
+
+
+#ifdef USE_STATS
+void g2dGetFrameStats(g2dFrameStats *stats)
+{
+    if (stats != NULL)
+        *stats = last_stats;
+}
+#endif
+
+
+void g2dPush()
+{
+    Transform *stack;
+    unsigned int cap;
+
+    // Grows on demand. Without room, nothing is pushed.
+    if (tstack_size == tstack_cap)
+    {
+        cap = (tstack_cap > 0 ? 2*tstack_cap : TSTACK_SIZE);
+        if ((stack = realloc(tstack, cap * sizeof(Transform))) == NULL)
+            return;
+
+        tstack = stack;
+        tstack_cap = cap;
+    }
+
+    tstack_size++;
+
+    TRANSFORM.x = rctx.cur_obj.x;
+    TRANSFORM.y = rctx.cur_obj.y;
+    TRANSFORM.z = rctx.cur_obj.z;
+    TRANSFORM.rot = rctx.cur_obj.rot;
+    TRANSFORM.rot_sin = rctx.cur_obj.rot_sin;
+    TRANSFORM.rot_cos = rctx.cur_obj.rot_cos;
+    TRANSFORM.scale_w = rctx.cur_obj.scale_w;
+    TRANSFORM.scale_h = rctx.cur_obj.scale_h;
+    TRANSFORM.mat = mat;
+}
+
+
+void g2dPop()
+{
+    if (tstack_size <= 0)
+        return;
+
+    rctx.cur_obj.x = TRANSFORM.x;
+    rctx.cur_obj.y = TRANSFORM.y;
+    rctx.cur_obj.z = TRANSFORM.z;
+    rctx.cur_obj.rot = TRANSFORM.rot;
+    rctx.cur_obj.rot_sin = TRANSFORM.rot_sin;
+    rctx.cur_obj.rot_cos = TRANSFORM.rot_cos;
+    rctx.cur_obj.scale_w = TRANSFORM.scale_w;
+    rctx.cur_obj.scale_h = TRANSFORM.scale_h;
+    mat = TRANSFORM.mat;
+    mat_dirty = true;
+
+    tstack_size--;
+    
+    if (rctx.cur_obj.rot != 0.f) rctx.use_rot = true;
+    if (rctx.cur_obj.z != 0.f)   rctx.use_z = true;
+}
+
+/* Matrix functions */
+
+void g2dResetMatrix()
+{
+    mat.a = 1.f; mat.b = 0.f; mat.x = 0.f;
+    mat.c = 0.f; mat.d = 1.f; mat.y = 0.f;
+    mat_dirty = true;
+}
+
+
+void g2dGetMatrix(float m[6])
+{
+    if (m == NULL)
+        return;
+
+    m[0] = mat.a; m[1] = mat.b; m[2] = mat.x;
+    m[3] = mat.c; m[4] = mat.d; m[5] = mat.y;
+}
+
+
+void g2dSetMatrix(const float m[6])
+{
+    if (m == NULL)
+        return;
+
+    mat.a = m[0]; mat.b = m[1]; mat.x = m[2];
+    mat.c = m[3]; mat.d = m[4]; mat.y = m[5];
+    mat_dirty = true;
+}
+
+
+void _g2dMatMultiply(const Matrix *m)
+{
+    Matrix r;
+
+    // mat = mat * m
+    r.a = mat.a*m->a + mat.b*m->c;
+    r.b = mat.a*m->b + mat.b*m->d;
+    r.x = mat.a*m->x + mat.b*m->y + mat.x;
+    r.c = mat.c*m->a + mat.d*m->c;
+    r.d = mat.c*m->b + mat.d*m->d;
+    r.y = mat.c*m->x + mat.d*m->y + mat.y;
+
+    mat = r;
+    mat_dirty = true;
+}
+
+
+void g2dMatrixTranslate(float x, float y)
+{
+    Matrix m = {1.f, 0.f, x * global_scale, 0.f, 1.f, y * global_scale};
+
+    _g2dMatMultiply(&m);
+}
+
+
+void g2dMatrixRotateRad(float radians)
+{
+    Matrix m = {1.f, 0.f, 0.f, 0.f, 1.f, 0.f};
+
+    _g2dSinCos(radians, &m.c, &m.a);
+    m.b = -m.c;
+    m.d = m.a;
+
+    _g2dMatMultiply(&m);
+}
+
+
+void g2dMatrixRotate(float degrees)
+{
+    g2dMatrixRotateRad(degrees * M_PI_180);
+}
+
+
+void g2dMatrixScale(float w, float h)
+{
+    Matrix m = {w, 0.f, 0.f, 0.f, h, 0.f};
+
+    _g2dMatMultiply(&m);
+}
+
+/* Batch functions */
+
+void g2dBatchBegin()
+{
+    if (!init)
+        g2dInit();
+
+    if (batch != NULL)
+        return;
+
+    _g2dFlush();
+
+    if ((batch = calloc(1, sizeof(g2dBatch))) == NULL)
+        return;
+
+    // Record in a call list, from a known state.
+    batch_parent = dlist;
+    batch_parent_state = gu_state;
+    gu_state.valid = false;
+    gu_state.tex_valid = false;
+
+    dlist = &batch->list;
+
+    if (!_g2dStartSegment(BATCH_SIZE))
+    {
+        dlist = batch_parent;
+        gu_state = batch_parent_state;
+        free(batch->list.seg);
+        free(batch);
+        batch = NULL;
+    }
+}
+
+
+g2dBatch* g2dBatchEnd()
+{
+    g2dBatch *b = batch;
+    unsigned int i;
+
+    if (b == NULL)
+        return NULL;
+
+    _g2dFlush();
+    sceGuFinish();
+
+    for (i=0; i<b->list.n; i++)
+        sceKernelDcacheWritebackRange(b->list.seg[i].data,
+                                      b->list.seg[i].size);
+
+    b->state = gu_state;
+
+    gu_state = batch_parent_state;
+    dlist = batch_parent;
+    batch = NULL;
+
+    return b;
+}
+
+
+void g2dBatchFree(g2dBatch **b)
+{
+    unsigned int i;
+
+    if (b == NULL)
+        return;
+    if (*b == NULL)
+        return;
+
+    for (i=0; i<(*b)->list.seg_nbr; i++)
+        free((*b)->list.seg[i].data);
+
+    free((*b)->list.seg);
+    free((*b)->draw);
+    free((*b));
+
+    *b = NULL;
+}
+
+
+void g2dDrawBatch(g2dBatch *b)
+{
+    unsigned int i;
+
+    if (b == NULL || batch != NULL)
+        return;
+
+    if (!start && !_g2dStart())
+        return;
+
+    _g2dFlush();
+
+    for (i=0; i<b->list.n; i++)
+    {
+        if (!_g2dReserve(0))
+            break;
+
+        sceGuCallList(b->list.seg[i].data);
+    }
+
+    // The GE is left as at the end of the batch. The texture could have been
+    // freed since, so it is sent again. Unknown if the batch was cut.
+    gu_state = b->state;
+    gu_state.tex = NULL;
+    gu_state.valid = (b->state.valid && i == b->list.n);
+    gu_state.tex_valid = (b->state.tex_valid && i == b->list.n);
+
+    if (b->use_z)
+        zclear = true;
+
+    STATS_ADD(draw_calls, b->n);
+    STATS_ADD(vertices, b->v_nbr);
+}
+
+
+void g2dDrawBatchXY(g2dBatch *b, float x, float y)
+{
+    RenderContext tmp;
+    BatchDraw *draw;
+    unsigned int i;
+    int j;
+
+    if (x == 0.f && y == 0.f)
+    {
+        g2dDrawBatch(b);
+        return;
+    }
+
+    if (b == NULL || batch != NULL)
+        return;
+
+    if (!start && !_g2dStart())
+        return;
+
+    _g2dFlush();
+
+    x *= global_scale;
+    y *= global_scale;
+
+    // Vertex coordinates can't be offset by the GE in through mode: the draws
+    // are sent again with translated copies of their vertices.
+    tmp = rctx;
+
+    for (i=0; i<b->n; i++)
+    {
+        draw = &b->draw[i];
+
+        rctx.tex = draw->tex;
+        rctx.cur_obj.color = draw->color;
+        rctx.use_z = draw->use_z;
+        rctx.use_vert_color = draw->use_vert_color;
+        rctx.use_tex_linear = draw->use_tex_linear;
+        rctx.use_tex_repeat = draw->use_tex_repeat;
+
+        if (!_g2dReserve(0))
+            break;
+
+        _g2dSetGuState();
+
+        // The coordinates follow the texture uv & the color.
+        char *v = _g2dGetMemory(draw->v_nbr * draw->size);
+        if (v == NULL)
+            break;
+
+        char *coord = v + (draw->type & GU_TEXTURE_BITS ? 2*sizeof(short) : 0) +
+                          (draw->type & GU_COLOR_BITS ? sizeof(g2dColor) : 0);
+
+        memcpy(v, draw->v, draw->v_nbr * draw->size);
+
+        for (j=0; j<draw->v_nbr; j++, coord+=draw->size)
+        {
+            if ((draw->type & GU_VERTEX_BITS) == GU_VERTEX_16BIT)
+            {
+                // Compact vertices are moved by whole pixels.
+                ((short*)coord)[0] += floorf(x);
+                ((short*)coord)[1] += floorf(y);
+            }
+            else
+            {
+                ((float*)coord)[0] += x;
+                ((float*)coord)[1] += y;
+            }
+        }
+
+        sceGuDrawArray(draw->prim, draw->type, draw->nbr, draw->idx, v);
+    }
+
+    _g2dRestoreColor();
+
+    rctx = tmp;
+
+    if (b->use_z)
+        zclear = true;
+
+    STATS_ADD(draw_calls, b->n);
+    STATS_ADD(vertices, b->v_nbr);
+}
+
+/* Coord functions */
+
+void g2dResetCoord()
+{
+    rctx.cur_obj.x = DEFAULT_X;
+    rctx.cur_obj.y = DEFAULT_Y;
+    rctx.cur_obj.z = DEFAULT_Z;
+}
+
+
+void g2dSetCoordMode(g2dCoord_Mode mode)
+{
+    if (mode > G2D_CENTER)
+        return;
+
+    rctx.coord_mode = mode;
+}
+
+
+void g2dGetCoordXYZ(float *x, float *y, float *z)
+{
+    if (x != NULL) *x = rctx.cur_obj.x;
+    if (y != NULL) *y = rctx.cur_obj.y;
+    if (z != NULL) *z = rctx.cur_obj.z;
+}
+
+
+void g2dSetCoordXY(float x, float y)
+{
+    rctx.cur_obj.x = x * global_scale;
+    rctx.cur_obj.y = y * global_scale;
+    rctx.cur_obj.z = 0.f;
+}
+
+
+void g2dSetCoordXYZ(float x, float y, float z)
+{
+    rctx.cur_obj.x = x * global_scale;
+    rctx.cur_obj.y = y * global_scale;
+    rctx.cur_obj.z = z * global_scale;
+
+    if (z != 0.f)
+        rctx.use_z = true;
+}
+
+
+void g2dSetCoordXYRelative(float x, float y)
+{
+    float inc_x = x;
+    float inc_y = y;
+
+    if (rctx.cur_obj.rot_cos != 1.f)
+    {
+        inc_x = -rctx.cur_obj.rot_sin*y + rctx.cur_obj.rot_cos*x;
+        inc_y =  rctx.cur_obj.rot_cos*y + rctx.cur_obj.rot_sin*x;
+    }
+
+    rctx.cur_obj.x += inc_x * global_scale;
+    rctx.cur_obj.y += inc_y * global_scale;
+}
+
+
+void g2dSetCoordXYZRelative(float x, float y, float z)
+{
+    g2dSetCoordXYRelative(x, y);
+
+    rctx.cur_obj.z += z * global_scale;
+
+    if (z != 0.f)
+        rctx.use_z = true;
+}
+
+
+void g2dSetCoordInteger(bool use)
+{
+    rctx.use_int = use;
+}
+
+
+void g2dSetCoordCompact(bool use)
+{
+    rctx.use_compact = use;
+}
+
+/* Scale functions */
+
+void g2dResetGlobalScale()
+{
+    global_scale = 1.f;
+}
+
+
+void g2dResetScale()
+{
+    if (rctx.tex == NULL)
+    {
+        rctx.cur_obj.scale_w = DEFAULT_SIZE;
+        rctx.cur_obj.scale_h = DEFAULT_SIZE;
+    }
+    else
+    {
+        rctx.cur_obj.scale_w = rctx.tex->w;
+        rctx.cur_obj.scale_h = rctx.tex->h;
+    }
+
+    rctx.cur_obj.scale_w *= global_scale;
+    rctx.cur_obj.scale_h *= global_scale;
+}
+
+
+void g2dGetGlobalScale(float *scale)
+{
+    if (scale != NULL)
+        *scale = global_scale;
+}
+
+
+void g2dGetScaleWH(float *w, float *h)
+{
+    if (w != NULL) *w = rctx.cur_obj.scale_w;
+    if (h != NULL) *h = rctx.cur_obj.scale_h;
+}
+
+
+void g2dSetGlobalScale(float scale)
+{
+    global_scale = scale;
+}
+
+
+void g2dSetScale(float w, float h)
+{
+    g2dResetScale();
+
+    g2dSetScaleRelative(w, h);
+}
+
+
+void g2dSetScaleWH(float w, float h)
+{
+    rctx.cur_obj.scale_w = w * global_scale;
+    rctx.cur_obj.scale_h = h * global_scale;
+
+    // A trick to prevent an unexpected behavior when mirroring with GU_SPRITES.
+    if (rctx.cur_obj.scale_w < 0 || rctx.cur_obj.scale_h < 0)
+        rctx.use_rot = true;
+}
+
+
+void g2dSetScaleRelative(float w, float h)
+{
+    rctx.cur_obj.scale_w *= w;
+    rctx.cur_obj.scale_h *= h;
+
+    if (rctx.cur_obj.scale_w < 0 || rctx.cur_obj.scale_h < 0)
+        rctx.use_rot = true;
+}
+
+
+void g2dSetScaleWHRelative(float w, float h)
+{
+    rctx.cur_obj.scale_w += w * global_scale;
+    rctx.cur_obj.scale_h += h * global_scale;
+
+    if (rctx.cur_obj.scale_w < 0 || rctx.cur_obj.scale_h < 0)
+        rctx.use_rot = true;
+}
+
+/* Color functions */
+
+void g2dResetColor()
+{
+    rctx.cur_obj.color = DEFAULT_COLOR;
+}
+
+
+void g2dResetAlpha()
+{
+    rctx.cur_obj.alpha = DEFAULT_ALPHA;
+}
+
+
+void g2dGetAlpha(g2dAlpha *alpha)
+{
+    if (alpha != NULL)
+        *alpha = rctx.cur_obj.alpha;
+}
+
+
+void g2dSetColor(g2dColor color)
+{
+    rctx.cur_obj.color = color;
+
+    if (++rctx.color_count > 1)
+        rctx.use_vert_color = true;
+}
+
+
+void g2dSetAlpha(g2dAlpha alpha)
+{
+    if (alpha < 0)   alpha = 0;
+    if (alpha > 255) alpha = 255;
+
+    rctx.cur_obj.alpha = alpha;
+
+    if (++rctx.color_count > 1)
+        rctx.use_vert_color = true;
+}
+
+
+void g2dSetAlphaRelative(int alpha)
+{
+    g2dSetAlpha(rctx.cur_obj.alpha + alpha);
+}
+
+/* Rotation functions */
+
+void g2dResetRotation()
+{
+    rctx.cur_obj.rot = 0.f;
+    rctx.cur_obj.rot_sin = 0.f;
+    rctx.cur_obj.rot_cos = 1.f;
+}
+
+
+float _g2dRotation()
+{
+    // Set by sine and cosine, the angle is only computed when asked for.
+    if (isnan(rctx.cur_obj.rot))
+        rctx.cur_obj.rot = atan2f(rctx.cur_obj.rot_sin, rctx.cur_obj.rot_cos);
+
+    return rctx.cur_obj.rot;
+}
+
+
+void g2dGetRotationRad(float *radians)
+{
+    if (radians != NULL)
+        *radians = _g2dRotation();
+}
+
+
+void g2dGetRotation(float *degrees)
+{
+    if (degrees != NULL)
+        *degrees = _g2dRotation() * M_180_PI;
+}
+
+
+void g2dSetRotationRad(float radians)
+{
+    if (radians == rctx.cur_obj.rot)
+        return;
+
+    rctx.cur_obj.rot = radians;
+
+    _g2dSinCos(radians, &rctx.cur_obj.rot_sin, &rctx.cur_obj.rot_cos);
+
+    if (radians != 0.f)
+        rctx.use_rot = true;
+}
+
+
+void g2dSetRotation(float degrees)
+{
+    g2dSetRotationRad(degrees * M_PI_180);
+}
+
+
+void g2dSetRotationSinCos(float sin, float cos)
+{
+    rctx.cur_obj.rot = NAN;
+    rctx.cur_obj.rot_sin = sin;
+    rctx.cur_obj.rot_cos = cos;
+
+    if (sin != 0.f || cos != 1.f)
+        rctx.use_rot = true;
+}
+
+
+void g2dSetRotationRadRelative(float radians)
+{
+    g2dSetRotationRad(_g2dRotation() + radians);
+}
+
+
+void g2dSetRotationRelative(float degrees)
+{
+    g2dSetRotationRadRelative(degrees * M_PI_180);
+}
+
+/* Crop functions */
+
+void g2dResetCrop()
+{
+    if (rctx.tex == NULL)
+        return;
+
+    rctx.cur_obj.crop_x = 0;
+    rctx.cur_obj.crop_y = 0;
+    rctx.cur_obj.crop_w = rctx.tex->w;
+    rctx.cur_obj.crop_h = rctx.tex->h;
+}
+
+
+void g2dGetCropXY(int *x, int *y)
+{
+    if (rctx.tex == NULL)
+        return;
+
+    if (x != NULL) *x = rctx.cur_obj.crop_x;
+    if (y != NULL) *y = rctx.cur_obj.crop_y;
+}
+
+
+void g2dGetCropWH(int *w, int *h)
+{
+    if (rctx.tex == NULL)
+        return;
+
+    if (w != NULL) *w = rctx.cur_obj.crop_w;
+    if (h != NULL) *h = rctx.cur_obj.crop_h;
+}
+
+
+void g2dSetCropXY(int x, int y)
+{
+    if (rctx.tex == NULL)
+        return;
+
+    rctx.cur_obj.crop_x = x;
+    rctx.cur_obj.crop_y = y;
+}
+
+
+void g2dSetCropWH(int w, int h)
+{
+    if (rctx.tex == NULL)
+        return;
+
+    rctx.cur_obj.crop_w = w;
+    rctx.cur_obj.crop_h = h;
+}
+
+
+void g2dSetCropXYRelative(int x, int y)
+{
+    if (rctx.tex == NULL)
+        return;
+
+    g2dSetCropXY(rctx.cur_obj.crop_x + x, rctx.cur_obj.crop_y + y);
+}
+
+
+void g2dSetCropWHRelative(int w, int h)
+{
+    if (rctx.tex == NULL)
+        return;
+
+    g2dSetCropWH(rctx.cur_obj.crop_w + w, rctx.cur_obj.crop_h + h);
+}
+
+/* Texture functions */
+
+void g2dResetTex()
+{
+    if (rctx.tex == NULL)
+        return;
+
+    rctx.use_tex_repeat = false;
+    rctx.use_tex_linear = true;
+}
+
+
+void g2dSetTexRepeat(bool use)
+{
+    if (rctx.tex == NULL)
+        return;
+
+    rctx.use_tex_repeat = use;
+}
+
+
+void g2dSetTexLinear(bool use)
+{
+    if (rctx.tex == NULL)
+        return;
+
+    rctx.use_tex_linear = use;
+}
+
+/* Texture management */
+
+unsigned int _getNextPower2(unsigned int n)
+{
+    n--;
+    n |= n >> 1;
+    n |= n >> 2;
+    n |= n >> 4;
+    n |= n >> 8;
+    n |= n >> 16;
+
+    return n+1;
+}
+
+
+void _swizzle(unsigned char *dest, unsigned char *source, int width, int height)
+{
+    int i, j;
+    int rowblocks = (width / 16);
+    int rowblocks_add = (rowblocks-1) * 128;
+    unsigned int block_address = 0;
+    unsigned int *img = (unsigned int*)source;
+
+    for (j=0; j<height; j++)
+    {
+        unsigned int *block = (unsigned int*)(dest + block_address);
+
+        for (i = 0; i < rowblocks; i++)
+        {
+            *block++ = *img++;
+            *block++ = *img++;
+            *block++ = *img++;
+            *block++ = *img++;
+
+            block += 28;
+        }
+
+        if ((j & 0x7) == 0x7)
+            block_address += rowblocks_add;
+
+        block_address += 16;
+    }
+}
+
+
+g2dTexture* _g2dTexCreate(int w, int h, int psm)
+{
+    g2dTexture *tex = malloc(sizeof(g2dTexture));
+    if (tex == NULL)
+        return NULL;
+
+    tex->tw = _getNextPower2(w);
+    tex->th = _getNextPower2(h);
+    tex->w = w;
+    tex->h = h;
+    tex->ratio = (float)w / h;
+    tex->swizzled = false;
+    tex->psm = psm;
+    tex->clut = NULL;
+
+    // The GE reads lines of 16 bytes at least, and blocks of 4*4 texels.
+    if (psm != GU_PSM_8888 && tex->tw * _g2dTexBits(psm) < 128)
+        tex->tw = 128 / _g2dTexBits(psm);
+    if (psm >= GU_PSM_DXT1 && tex->th < 4)
+        tex->th = 4;
+
+    tex->data = malloc(_g2dTexSize(tex));
+    if (tex->data == NULL)
+    {
+        free(tex);
+        return NULL;
+    }
+
+    memset(tex->data, 0, _g2dTexSize(tex));
+
+    if (psm == GU_PSM_T4 || psm == GU_PSM_T8)
+    {
+        tex->clut = memalign(16, 256 * sizeof(g2dColor));
+        if (tex->clut == NULL)
+        {
+            free(tex->data);
+            free(tex);
+            return NULL;
+        }
+
+        memset(tex->clut, 0, 256 * sizeof(g2dColor));
+    }
+
+    return tex;
+}
+
+
+int _g2dTexModePsm(g2dTex_Mode mode)
+{
+    if (mode & G2D_T4)   return GU_PSM_T4;
+    if (mode & G2D_T8)   return GU_PSM_T8;
+    if (mode & G2D_5650) return GU_PSM_5650;
+    if (mode & G2D_5551) return GU_PSM_5551;
+    if (mode & G2D_4444) return GU_PSM_4444;
+
+    return GU_PSM_8888;
+}
+
+
+g2dTexture* g2dTexCreate(int w, int h, g2dTex_Mode mode)
+{
+    return _g2dTexCreate(w, h, _g2dTexModePsm(mode));
+}
+
+
+void _g2dTexSwizzle(g2dTexture *tex)
 {
-    g2dTexture *tex = malloc(sizeof(g2dTexture));
-    if (tex == NULL)
-        return NULL;
+    u8 *tmp = malloc(_g2dTexSize(tex));
 
-    tex->tw = _getNextPower2(w);
-    tex->th = _getNextPower2(h);
-    tex->w = w;
-    tex->h = h;
-    tex->ratio = (float)w / h;
-    tex->swizzled = false;
+    if (tmp == NULL)
+        return;
 
-    tex->data = malloc(tex->tw * tex->th * sizeof(g2dColor));
-    if (tex->data == NULL)
-    {
-        free(tex);
-        return NULL;
-    }
+    // Rows in bytes, as texels of any format fill the 16 bytes blocks.
+    _swizzle(tmp, (u8*)tex->data, tex->tw * _g2dTexBits(tex->psm) / 8,
+             tex->th);
+    free(tex->data);
+    tex->data = (g2dColor*)tmp;
+    tex->swizzled = true;
+}
 
-    memset(tex->data, 0, tex->tw * tex->th * sizeof(g2dColor));
 
-    return tex;
+static INLINE void _g2dTexSetIndex(g2dTexture *tex, int x, int y,
+                                   unsigned int i)
+{
+    u8 *p = (u8*)tex->data + (x + y*tex->tw) * _g2dTexBits(tex->psm) / 8;
+
+    if (tex->psm == GU_PSM_T8)
+        *p = i;
+    else // Even texels in the low nibble.
+        *p = (x & 1 ? (*p & 0x0F) | (i << 4) : (*p & 0xF0) | i);
 }
 
 
@@ -1180,139 +3724,554 @@ void g2dTexFree(g2dTexture **tex)
     if (*tex == NULL)
         return;
 
+    if (pending.tex == *tex)
+        _g2dFlush();
+
+    // The same address could be given to a new texture.
+    if (gu_state.tex == *tex)
+        gu_state.tex = NULL;
+    if (gu_state.clut == (*tex)->clut)
+        gu_state.clut = NULL;
+
+    _g2dVramDrop(*tex);
+
     free((*tex)->data);
+    free((*tex)->clut);
     free((*tex));
 
-    *tex = NULL;
-}
+    *tex = NULL;
+}
+
+
+void g2dTexUpdate(g2dTexture *tex)
+{
+    if (tex == NULL)
+        return;
+
+    // Loaded again, this flushes the texture cache.
+    if (gu_state.tex == tex)
+        gu_state.tex = NULL;
+    if (gu_state.clut == tex->clut)
+        gu_state.clut = NULL;
+
+    _g2dVramDrop(tex);
+
+    sceKernelDcacheWritebackRange(tex->data, _g2dTexSize(tex));
+
+    if (tex->clut != NULL)
+        sceKernelDcacheWritebackRange(tex->clut, 256 * sizeof(g2dColor));
+}
+
+
+#ifdef USE_PNG
+g2dTexture* _g2dTexLoadPNG(FILE *fp, int psm)
+{
+    png_structp png_ptr;
+    png_infop info_ptr;
+    unsigned int sig_read = 0;
+    png_uint_32 width, height;
+    int bit_depth, color_type, interlace_type;
+    png_colorp palette;
+    png_bytep trans;
+    int palette_n = 0, trans_n = 0;
+    u32 x, y;
+    g2dColor *line;
+    g2dTexture *tex;
+
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_set_error_fn(png_ptr, NULL, NULL, NULL);
+    info_ptr = png_create_info_struct(png_ptr);
+    png_init_io(png_ptr, fp);
+    png_set_sig_bytes(png_ptr, sig_read);
+    png_read_info(png_ptr, info_ptr);
+    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, 
+                 &interlace_type, NULL, NULL);
+    png_set_strip_16(png_ptr);
+    png_set_packing(png_ptr);
+
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+        png_get_PLTE(png_ptr, info_ptr, &palette, &palette_n);
+
+    // Palettes which fit are kept for indexed textures, indices are read as
+    // bytes. Other textures are converted from truecolor by g2dTexLoad().
+    if ((psm != GU_PSM_T4 && psm != GU_PSM_T8) || palette_n == 0 ||
+        palette_n > (psm == GU_PSM_T4 ? 16 : 256))
+    {
+        psm = GU_PSM_8888;
+
+        if (color_type == PNG_COLOR_TYPE_PALETTE)
+            png_set_palette_to_rgb(png_ptr);
+        if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+            png_set_tRNS_to_alpha(png_ptr);
+
+        png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
+    }
+    else if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+        png_get_tRNS(png_ptr, info_ptr, &trans, &trans_n, NULL);
+    
+    tex = _g2dTexCreate(width, height, psm);
+    line = malloc(width * 4);
+
+    for (y = 0; y < height; y++)
+    {
+        png_read_row(png_ptr, (u8*) line, NULL);
+        
+        for (x = 0; x < width; x++)
+        {
+            if (psm == GU_PSM_8888)
+                tex->data[x + y*tex->tw] = line[x];
+            else
+                _g2dTexSetIndex(tex, x, y, ((u8*)line)[x]);
+        }
+    }
+
+    for (x = 0; x < (u32)palette_n && psm != GU_PSM_8888; x++)
+    {
+        tex->clut[x] = palette[x].red | (palette[x].green << 8) |
+                       (palette[x].blue << 16) |
+                       ((x < (u32)trans_n ? trans[x] : 0xff) << 24);
+    }
+
+    free(line);
+    png_read_end(png_ptr, info_ptr);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+    return tex;
+}
+#endif
+
+
+#ifdef USE_JPEG
+g2dTexture* _g2dTexLoadJPEG(FILE *fp)
+{
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_error_mgr jerr;
+    int width, height;
+    g2dTexture *tex;
+    u8 *line;
+
+    dinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&dinfo);
+    jpeg_stdio_src(&dinfo, fp);
+    jpeg_read_header(&dinfo, TRUE);
+
+    width = dinfo.image_width;
+    height = dinfo.image_height;
+    tex = g2dTexCreate(width, height, G2D_VOID);
+    line = malloc(width * 3);
+    
+    jpeg_start_decompress(&dinfo);
+    
+    if (dinfo.jpeg_color_space == JCS_GRAYSCALE)
+    {
+        while (dinfo.output_scanline < dinfo.output_height)
+        {
+            int y = dinfo.output_scanline;
+            int x;
+
+            jpeg_read_scanlines(&dinfo, &line, 1);
+
+            for (x=0; x<width; x++)
+            {
+                g2dColor gray = line[x];
+                g2dColor c = gray | (gray << 8) | (gray << 16) | 0xff000000;
+
+                tex->data[x + tex->tw * y] = c;
+            }
+        }
+    }
+    else
+    {
+        while (dinfo.output_scanline < dinfo.output_height)
+        {
+            int y = dinfo.output_scanline;
+            int x;
+            u8 *pline;
+
+            jpeg_read_scanlines(&dinfo, &line, 1);
+            pline = line;
+
+            for (x=0; x<width; x++)
+            {
+                g2dColor c;
+
+                c  = (*(pline++));
+                c |= (*(pline++)) << 8;
+                c |= (*(pline++)) << 16;
+
+                tex->data[x + tex->tw * y] = c | 0xff000000;
+            }
+        }
+    }
+
+    jpeg_finish_decompress(&dinfo);
+    jpeg_destroy_decompress(&dinfo);
+    free(line);
+
+    return tex;
+}
+#endif
+
+
+void _g2dDXTBlock(u8 *dst, const u8 *src, int psm)
+{
+    const u8 *color = (psm == GU_PSM_DXT1 ? src : src + 8);
+
+    // The GE reads the color indices before the endpoints, then the alpha
+    // block, whose codes are before the endpoints. Endpoints are standard
+    // RGB565 ones, red in the high bits, they are kept as they are.
+    memcpy(dst, color + 4, 4);
+    memcpy(dst + 4, color, 4);
+
+    if (psm == GU_PSM_DXT3)
+    {
+        memcpy(dst + 8, src, 8);
+    }
+    else if (psm == GU_PSM_DXT5)
+    {
+        memcpy(dst + 8, src + 2, 6);
+        memcpy(dst + 14, src, 2);
+    }
+}
+
+
+g2dTexture* _g2dTexLoadDDS(FILE *fp)
+{
+    unsigned int header[32];
+    unsigned int i, bx, by, bw, bh, size;
+    g2dTexture *tex;
+    u8 *line, *dst;
+    long pos, end;
+    int psm;
+
+    // Magic, then a 124 bytes header, the FourCC at 84.
+    if (fread(header, sizeof(header), 1, fp) != 1 ||
+        memcmp(&header[0], "DDS ", 4) != 0)
+        return NULL;
+
+    if (memcmp(&header[21], "DXT1", 4) == 0)
+        psm = GU_PSM_DXT1;
+    else if (memcmp(&header[21], "DXT3", 4) == 0)
+        psm = GU_PSM_DXT3;
+    else if (memcmp(&header[21], "DXT5", 4) == 0)
+        psm = GU_PSM_DXT5;
+    else
+        return NULL;
+
+    // Checked before the allocation: the PSP can't draw 512*512+ textures.
+    if (header[4] < 1 || header[4] > 512 || header[3] < 1 || header[3] > 512)
+        return NULL;
+
+    size = (psm == GU_PSM_DXT1 ? 8 : 16);
+    bw = (header[4] + 3) / 4;
+    bh = (header[3] + 3) / 4;
+
+    // The blocks of the first mipmap level must all be in the file.
+    if ((pos = ftell(fp)) < 0 || fseek(fp, 0, SEEK_END) != 0 ||
+        (end = ftell(fp)) < 0 || fseek(fp, pos, SEEK_SET) != 0 ||
+        end - pos < (long)(bw * bh * size))
+        return NULL;
+
+    if ((tex = _g2dTexCreate(header[4], header[3], psm)) == NULL)
+        return NULL;
+
+    // Blocks out of the image are transparent (3rd color, DXT1 only).
+    for (i=0; i<_g2dTexSize(tex)/size && psm == GU_PSM_DXT1; i++)
+        ((unsigned int*)tex->data)[2*i] = 0xFFFFFFFF;
+
+    // Only the first mipmap level is read.
+    if ((line = malloc(bw * size)) == NULL)
+    {
+        g2dTexFree(&tex);
+        return NULL;
+    }
+
+    for (by=0; by<bh; by++)
+    {
+        if (fread(line, bw * size, 1, fp) != 1)
+        {
+            g2dTexFree(&tex);
+            break;
+        }
+
+        dst = (u8*)tex->data + by * (tex->tw / 4) * size;
+
+        for (bx=0; bx<bw; bx++)
+            _g2dDXTBlock(dst + bx*size, line + bx*size, psm);
+    }
+
+    free(line);
+
+    return tex;
+}
+
+
+int _g2dQuantCompareColor(const void *a, const void *b)
+{
+    g2dColor ca = ((const QuantColor*)a)->color;
+    g2dColor cb = ((const QuantColor*)b)->color;
+
+    return (ca > cb) - (ca < cb);
+}
+
+
+int _g2dQuantCompareChannel(const void *a, const void *b)
+{
+    int ca = (((const QuantColor*)a)->color >> quant_shift) & 0xFF;
+    int cb = (((const QuantColor*)b)->color >> quant_shift) & 0xFF;
+
+    return ca - cb;
+}
+
+
+void _g2dQuantBoxRange(QuantBox *box, const QuantColor *colors)
+{
+    unsigned int i;
+    int shift, c, lo, hi;
+
+    box->range = -1;
+
+    for (shift=0; shift<32; shift+=8)
+    {
+        for (i=box->first, lo=255, hi=0; i<box->first+box->n; i++)
+        {
+            c = (colors[i].color >> shift) & 0xFF;
+            if (c < lo) lo = c;
+            if (c > hi) hi = c;
+        }
+
+        if (hi - lo > box->range)
+        {
+            box->range = hi - lo;
+            box->shift = shift;
+        }
+    }
+}
+
+
+g2dTexture* _g2dTexQuantize(const g2dTexture *src, int psm)
+{
+    unsigned int colors_max = (psm == GU_PSM_T4 ? 16 : 256);
+    unsigned int i, j, k, n, box_n, count, sum;
+    unsigned long acc[4];
+    QuantColor *colors, *c, key;
+    QuantBox boxes[256], *box;
+    g2dTexture *tex;
+    int x, y;
+
+    tex = _g2dTexCreate(src->w, src->h, psm);
+    colors = malloc(src->w * src->h * sizeof(QuantColor));
+
+    if (tex == NULL || colors == NULL)
+    {
+        free(colors);
+        g2dTexFree(&tex);
+        return NULL;
+    }
+
+    // Histogram.
+    for (y=0, n=0; y<src->h; y++)
+    {
+        for (x=0; x<src->w; x++, n++)
+        {
+            colors[n].color = src->data[x + y*src->tw];
+            colors[n].count = 1;
+        }
+    }
+
+    qsort(colors, n, sizeof(QuantColor), _g2dQuantCompareColor);
+
+    for (i=1, k=1; i<n; i++)
+    {
+        if (colors[i].color == colors[k-1].color)
+            colors[k-1].count++;
+        else
+            colors[k++] = colors[i];
+    }
+
+    n = k;
+
+    // Median cut: the box with the widest channel is split in two halves
+    // of texels, until there are enough boxes or single colors only.
+    boxes[0].first = 0;
+    boxes[0].n = n;
+    _g2dQuantBoxRange(&boxes[0], colors);
+
+    for (box_n=1; box_n<colors_max; box_n++)
+    {
+        for (i=0, box=NULL; i<box_n; i++)
+        {
+            if (boxes[i].n > 1 && (box == NULL || boxes[i].range > box->range))
+                box = &boxes[i];
+        }
+
+        if (box == NULL)
+            break;
+
+        quant_shift = box->shift;
+        qsort(&colors[box->first], box->n, sizeof(QuantColor),
+              _g2dQuantCompareChannel);
+
+        for (i=0, count=0; i<box->n; i++)
+            count += colors[box->first+i].count;
+
+        for (k=0, sum=0; k<box->n-1 && sum < count/2; k++)
+            sum += colors[box->first+k].count;
+
+        boxes[box_n].first = box->first + k;
+        boxes[box_n].n = box->n - k;
+        box->n = k;
+        _g2dQuantBoxRange(box, colors);
+        _g2dQuantBoxRange(&boxes[box_n], colors);
+    }
 
+    // Palette entries are the average of their box.
+    for (j=0; j<box_n; j++)
+    {
+        memset(acc, 0, sizeof(acc));
 
-#ifdef USE_PNG
-g2dTexture* _g2dTexLoadPNG(FILE *fp)
-{
-    png_structp png_ptr;
-    png_infop info_ptr;
-    unsigned int sig_read = 0;
-    png_uint_32 width, height;
-    int bit_depth, color_type, interlace_type;
-    u32 x, y;
-    g2dColor *line;
-    g2dTexture *tex;
+        for (i=boxes[j].first, count=0; i<boxes[j].first+boxes[j].n; i++)
+        {
+            for (k=0; k<4; k++)
+                acc[k] += ((colors[i].color >> (k*8)) & 0xFF) * colors[i].count;
 
-    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    png_set_error_fn(png_ptr, NULL, NULL, NULL);
-    info_ptr = png_create_info_struct(png_ptr);
-    png_init_io(png_ptr, fp);
-    png_set_sig_bytes(png_ptr, sig_read);
-    png_read_info(png_ptr, info_ptr);
-    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, 
-                 &interlace_type, NULL, NULL);
-    png_set_strip_16(png_ptr);
-    png_set_packing(png_ptr);
+            count += colors[i].count;
+            colors[i].index = j;
+        }
 
-    if (color_type == PNG_COLOR_TYPE_PALETTE)
-        png_set_palette_to_rgb(png_ptr);
-    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
-        png_set_tRNS_to_alpha(png_ptr);
+        for (k=0; k<4; k++)
+            tex->clut[j] |= ((acc[k] + count/2) / count) << (k*8);
+    }
 
-    png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
-    
-    tex = g2dTexCreate(width, height);
-    line = malloc(width * 4);
+    // Texels take the entry of their color box.
+    qsort(colors, n, sizeof(QuantColor), _g2dQuantCompareColor);
 
-    for (y = 0; y < height; y++)
+    for (y=0; y<src->h; y++)
     {
-        png_read_row(png_ptr, (u8*) line, NULL);
-        
-        for (x = 0; x < width; x++)
-            tex->data[x + y*tex->tw] = line[x];
+        for (x=0; x<src->w; x++)
+        {
+            key.color = src->data[x + y*src->tw];
+            c = bsearch(&key, colors, n, sizeof(QuantColor),
+                        _g2dQuantCompareColor);
+
+            _g2dTexSetIndex(tex, x, y, c->index);
+        }
     }
 
-    free(line);
-    png_read_end(png_ptr, info_ptr);
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    free(colors);
 
     return tex;
 }
-#endif
 
 
-#ifdef USE_JPEG
-g2dTexture* _g2dTexLoadJPEG(FILE *fp)
+static INLINE int _g2dDitherChannel(int c, int bits, int d)
 {
-    struct jpeg_decompress_struct dinfo;
-    struct jpeg_error_mgr jerr;
-    int width, height;
+    // Rounded with an offset of d/32, 16 for the nearest value.
+    return (c * ((1 << bits) - 1) * 32 + d * 255) / (255 * 32);
+}
+
+
+static INLINE int _g2dExpandChannel(int q, int bits)
+{
+    // Bit replication, as done by the GE.
+    return (q << (8 - bits)) | (q >> (2*bits - 8));
+}
+
+
+g2dTexture* _g2dTexConvert16(const g2dTexture *src, int psm, g2dTex_Mode mode)
+{
+    // Bits of R, G, B & A.
+    static const int formats[3][4] = {{5, 6, 5, 0}, {5, 5, 5, 1},
+                                      {4, 4, 4, 4}};
+    static const int bayer[4][4] = {{ 0,  8,  2, 10}, {12,  4, 14,  6},
+                                    { 3, 11,  1,  9}, {15,  7, 13,  5}};
+    const int *bits = formats[psm];
+    int *rows = NULL, *err = NULL, *next = NULL;
+    int x, y, k, c, q, e, d, shift;
+    unsigned short *line;
+    g2dColor color;
     g2dTexture *tex;
-    u8 *line;
 
-    dinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_decompress(&dinfo);
-    jpeg_stdio_src(&dinfo, fp);
-    jpeg_read_header(&dinfo, TRUE);
+    tex = _g2dTexCreate(src->w, src->h, psm);
 
-    width = dinfo.image_width;
-    height = dinfo.image_height;
-    tex = g2dTexCreate(width, height);
-    line = malloc(width * 3);
-    
-    jpeg_start_decompress(&dinfo);
-    
-    if (dinfo.jpeg_color_space == JCS_GRAYSCALE)
+    // Error rows for R, G & B, with a texel of margin on both sides.
+    if (tex != NULL && (mode & G2D_DIFFUSE))
     {
-        while (dinfo.output_scanline < dinfo.output_height)
-        {
-            int y = dinfo.output_scanline;
-            int x;
+        rows = calloc(2 * 3 * (src->w + 2), sizeof(int));
+        err = rows;
+        next = rows + 3 * (src->w + 2);
 
-            jpeg_read_scanlines(&dinfo, &line, 1);
+        if (rows == NULL)
+            g2dTexFree(&tex);
+    }
 
-            for (x=0; x<width; x++)
-            {
-                g2dColor gray = line[x];
-                g2dColor c = gray | (gray << 8) | (gray << 16) | 0xff000000;
+    if (tex == NULL)
+        return NULL;
 
-                tex->data[x + tex->tw * y] = c;
-            }
-        }
-    }
-    else
+    for (y=0; y<src->h; y++)
     {
-        while (dinfo.output_scanline < dinfo.output_height)
-        {
-            int y = dinfo.output_scanline;
-            int x;
-            u8 *pline;
+        line = (unsigned short*)tex->data + y*tex->tw;
 
-            jpeg_read_scanlines(&dinfo, &line, 1);
-            pline = line;
+        for (x=0; x<src->w; x++)
+        {
+            color = src->data[x + y*src->tw];
+            d = (mode & G2D_DITHER ? 2*bayer[y & 3][x & 3] + 1 : 16);
 
-            for (x=0; x<width; x++)
+            for (k=0, shift=0; k<4; shift+=bits[k], k++)
             {
-                g2dColor c;
+                c = (color >> (k*8)) & 0xFF;
+
+                if (bits[k] == 0)
+                    continue;
+
+                // Alpha is only rounded, dithering it would show holes.
+                if (k == 3)
+                {
+                    q = _g2dDitherChannel(c, bits[k], 16);
+                }
+                else if (rows != NULL)
+                {
+                    c += err[3*(x+1) + k] / 16;
+                    c = (c < 0 ? 0 : (c > 255 ? 255 : c));
+                    q = _g2dDitherChannel(c, bits[k], 16);
+                    e = c - _g2dExpandChannel(q, bits[k]);
+
+                    // Floyd-Steinberg: 7/16 right, 3/16, 5/16 & 1/16 below.
+                    err[3*(x+2) + k] += e * 7;
+                    next[3*x + k] += e * 3;
+                    next[3*(x+1) + k] += e * 5;
+                    next[3*(x+2) + k] += e;
+                }
+                else
+                {
+                    q = _g2dDitherChannel(c, bits[k], d);
+                }
+
+                line[x] |= q << shift;
+            }
+        }
 
-                c  = (*(pline++));
-                c |= (*(pline++)) << 8;
-                c |= (*(pline++)) << 16;
+        if (rows != NULL)
+        {
+            int *tmp = err;
 
-                tex->data[x + tex->tw * y] = c | 0xff000000;
-            }
+            err = next;
+            next = tmp;
+            memset(next, 0, 3 * (src->w + 2) * sizeof(int));
         }
     }
 
-    jpeg_finish_decompress(&dinfo);
-    jpeg_destroy_decompress(&dinfo);
-    free(line);
+    free(rows);
 
     return tex;
 }
-#endif
 
 
 g2dTexture* g2dTexLoad(char path[], g2dTex_Mode mode)
 {
     g2dTexture *tex = NULL;
     FILE *fp = NULL;
+    int psm = _g2dTexModePsm(mode);
 
     if (path == NULL)
         return NULL;
@@ -1322,7 +4281,7 @@ g2dTexture* g2dTexLoad(char path[], g2dTex_Mode mode)
 #ifdef USE_PNG
     if (strstr(path, ".png"))
     {
-        tex = _g2dTexLoadPNG(fp);
+        tex = _g2dTexLoadPNG(fp, psm);
     }
 #endif
 
@@ -1333,6 +4292,11 @@ g2dTexture* g2dTexLoad(char path[], g2dTex_Mode mode)
     }
 #endif
 
+    if (strstr(path, ".dds"))
+    {
+        tex = _g2dTexLoadDDS(fp);
+    }
+
     if (tex == NULL)
         goto error;
 
@@ -1343,19 +4307,30 @@ g2dTexture* g2dTexLoad(char path[], g2dTex_Mode mode)
     if (tex->w > 512 || tex->h > 512)
         goto error;
 
-    // Swizzling is useless with small textures.
-    if ((mode & G2D_SWIZZLE) && (tex->w >= 16 || tex->h >= 16))
+    // Loaded in truecolor, converted to the texel format. Compressed
+    // textures are kept as they are.
+    if (tex->psm != psm && tex->psm == GU_PSM_8888)
     {
-        u8 *tmp = malloc(tex->tw*tex->th*PIXEL_SIZE);
-        _swizzle(tmp, (u8*)tex->data, tex->tw*PIXEL_SIZE, tex->th);
-        free(tex->data);
-        tex->data = (g2dColor*)tmp;
-        tex->swizzled = true;
+        g2dTexture *tmp = (psm == GU_PSM_T4 || psm == GU_PSM_T8 ?
+                           _g2dTexQuantize(tex, psm) :
+                           _g2dTexConvert16(tex, psm, mode));
+
+        g2dTexFree(&tex);
+        if ((tex = tmp) == NULL)
+            goto error;
     }
+
+    // Swizzling is useless with small textures, and not done on blocks.
+    if ((mode & G2D_SWIZZLE) && (tex->w >= 16 || tex->h >= 16) &&
+        tex->psm < GU_PSM_DXT1)
+        _g2dTexSwizzle(tex);
     else
         tex->swizzled = false;
 
-    sceKernelDcacheWritebackRange(tex->data, tex->tw*tex->th*PIXEL_SIZE);
+    sceKernelDcacheWritebackRange(tex->data, _g2dTexSize(tex));
+
+    if (tex->clut != NULL)
+        sceKernelDcacheWritebackRange(tex->clut, 256 * sizeof(g2dColor));
 
     return tex;
 
@@ -1369,6 +4344,300 @@ error:
     return NULL;
 }
 
+/* Atlas functions */
+
+g2dAtlas* g2dAtlasCreate(bool swizzle)
+{
+    g2dAtlas *atlas = calloc(1, sizeof(g2dAtlas));
+
+    if (atlas != NULL)
+        atlas->swizzled = swizzle;
+
+    return atlas;
+}
+
+
+void g2dAtlasFree(g2dAtlas **atlas)
+{
+    unsigned int i;
+
+    if (atlas == NULL || *atlas == NULL)
+        return;
+
+    for (i=0; i<(*atlas)->page_n; i++)
+    {
+        g2dTexFree(&(*atlas)->pages[i]->tex);
+        free((*atlas)->pages[i]);
+    }
+
+    for (i=0; i<(*atlas)->image_n; i++)
+        free((*atlas)->images[i]);
+
+    free((*atlas)->pages);
+    free((*atlas)->images);
+    free(*atlas);
+    *atlas = NULL;
+}
+
+
+bool _g2dSkylineFit(const AtlasPage *page, int k, int w, int h, int *y)
+{
+    int i, left = w;
+
+    if (page->sky[k].x + w > ATLAS_PAGE_SIZE)
+        return false;
+
+    // The rect rests on the highest node it spans.
+    for (i=k, *y=0; left>0; left-=page->sky[i].w, i++)
+    {
+        if (page->sky[i].y > *y)
+            *y = page->sky[i].y;
+    }
+
+    return *y + h <= ATLAS_PAGE_SIZE;
+}
+
+
+void _g2dSkylineRemove(AtlasPage *page, int k)
+{
+    memmove(&page->sky[k], &page->sky[k+1],
+            (page->sky_n - k - 1) * sizeof(SkylineNode));
+    page->sky_n--;
+}
+
+
+void _g2dSkylineAdd(AtlasPage *page, int k, int y, int w, int h)
+{
+    int x = page->sky[k].x;
+    int i, cut;
+
+    memmove(&page->sky[k+1], &page->sky[k],
+            (page->sky_n - k) * sizeof(SkylineNode));
+    page->sky_n++;
+    page->sky[k].y = y + h;
+    page->sky[k].w = w;
+
+    // The nodes under the rect are shortened or removed.
+    for (i=k+1; i<page->sky_n && page->sky[i].x < x+w; )
+    {
+        cut = x + w - page->sky[i].x;
+
+        if (cut < page->sky[i].w)
+        {
+            page->sky[i].x += cut;
+            page->sky[i].w -= cut;
+            break;
+        }
+
+        _g2dSkylineRemove(page, i);
+    }
+
+    // Neighbours at the same height are merged.
+    for (i=0; i+1<page->sky_n; )
+    {
+        if (page->sky[i].y == page->sky[i+1].y)
+        {
+            page->sky[i].w += page->sky[i+1].w;
+            _g2dSkylineRemove(page, i+1);
+        }
+        else
+            i++;
+    }
+}
+
+
+bool _g2dSkylinePack(AtlasPage *page, int w, int h, int *x, int *y)
+{
+    int k, best = -1, best_y = 0, top;
+
+    // Bottom-left: the lowest top edge, then the leftmost.
+    for (k=0; k<page->sky_n; k++)
+    {
+        if (_g2dSkylineFit(page, k, w, h, &top) &&
+            (best < 0 || top < best_y))
+        {
+            best = k;
+            best_y = top;
+        }
+    }
+
+    if (best < 0)
+        return false;
+
+    *x = page->sky[best].x;
+    *y = best_y;
+    _g2dSkylineAdd(page, best, best_y, w, h);
+
+    return true;
+}
+
+
+AtlasPage* _g2dAtlasNewPage(g2dAtlas *atlas)
+{
+    AtlasPage **pages, *page;
+
+    // Room for the page first, the atlas is kept as is on failure.
+    pages = realloc(atlas->pages, (atlas->page_n+1) * sizeof(AtlasPage*));
+    if (pages == NULL)
+        return NULL;
+
+    atlas->pages = pages;
+
+    if ((page = malloc(sizeof(AtlasPage))) == NULL)
+        return NULL;
+
+    page->tex = g2dTexCreate(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, G2D_VOID);
+    if (page->tex == NULL)
+    {
+        free(page);
+        return NULL;
+    }
+
+    page->tex->swizzled = atlas->swizzled;
+    page->sky[0].x = 0;
+    page->sky[0].y = 0;
+    page->sky[0].w = ATLAS_PAGE_SIZE;
+    page->sky_n = 1;
+
+    atlas->pages[atlas->page_n++] = page;
+
+    return page;
+}
+
+
+void _g2dAtlasCopy(g2dTexture *tex, int x, int y,
+                   const g2dColor *data, int w, int h, int stride)
+{
+    unsigned int row = tex->tw * PIXEL_SIZE;
+    unsigned int xb, off;
+    int i, j, si, sj;
+    int y0 = y - ATLAS_PADDING, y1 = y + h + ATLAS_PADDING;
+
+    // The edges are repeated in the padding, against filtering bleeds.
+    for (j=-ATLAS_PADDING; j<h+ATLAS_PADDING; j++)
+    {
+        sj = (j < 0 ? 0 : (j >= h ? h-1 : j));
+
+        for (i=-ATLAS_PADDING; i<w+ATLAS_PADDING; i++)
+        {
+            si = (i < 0 ? 0 : (i >= w ? w-1 : i));
+            xb = (x + i) * PIXEL_SIZE;
+            off = (y + j) * row + xb;
+
+            if (tex->swizzled) // 16 bytes * 8 lines blocks, see _swizzle()
+                off = (((y+j) >> 3) * (row >> 4) + (xb >> 4)) * 128 +
+                      (((y+j) & 7) << 4) + (xb & 15);
+
+            *(g2dColor*)((u8*)tex->data + off) = data[si + sj*stride];
+        }
+    }
+
+    // Only the rows written, whole blocks when swizzled.
+    if (tex->swizzled)
+    {
+        y0 &= ~7;
+        y1 = (y1 + 7) & ~7;
+    }
+
+    sceKernelDcacheWritebackRange((u8*)tex->data + y0*row, (y1-y0)*row);
+
+    // The page may be in the VRAM pool already.
+    _g2dVramDrop(tex);
+}
+
+
+g2dAtlasImage* g2dAtlasAdd(g2dAtlas *atlas, const g2dColor *data,
+                           int w, int h, int stride)
+{
+    g2dAtlasImage **images, *img;
+    AtlasPage *page = NULL;
+    int pw = w + 2*ATLAS_PADDING;
+    int ph = h + 2*ATLAS_PADDING;
+    int x, y;
+    unsigned int i;
+
+    if (atlas == NULL || data == NULL || w <= 0 || h <= 0 ||
+        pw > ATLAS_PAGE_SIZE || ph > ATLAS_PAGE_SIZE)
+        return NULL;
+
+    // Allocated before packing, so that a failure leaves the pages as they
+    // are.
+    images = realloc(atlas->images,
+                     (atlas->image_n+1) * sizeof(g2dAtlasImage*));
+    if (images == NULL)
+        return NULL;
+
+    atlas->images = images;
+
+    if ((img = malloc(sizeof(g2dAtlasImage))) == NULL)
+        return NULL;
+
+    // First page with room, or a new one.
+    for (i=0; i<atlas->page_n && page == NULL; i++)
+    {
+        if (_g2dSkylinePack(atlas->pages[i], pw, ph, &x, &y))
+            page = atlas->pages[i];
+    }
+
+    if (page == NULL)
+    {
+        if ((page = _g2dAtlasNewPage(atlas)) == NULL)
+        {
+            free(img);
+            return NULL;
+        }
+
+        _g2dSkylinePack(page, pw, ph, &x, &y);
+    }
+
+    img->tex = page->tex;
+    img->x = x + ATLAS_PADDING;
+    img->y = y + ATLAS_PADDING;
+    img->w = w;
+    img->h = h;
+
+    _g2dAtlasCopy(page->tex, img->x, img->y, data, w, h, stride);
+
+    atlas->images[atlas->image_n++] = img;
+
+    return img;
+}
+
+
+g2dAtlasImage* g2dAtlasAddTex(g2dAtlas *atlas, const g2dTexture *tex)
+{
+    if (tex == NULL || tex->swizzled || tex->psm != GU_PSM_8888)
+        return NULL;
+
+    return g2dAtlasAdd(atlas, tex->data, tex->w, tex->h, tex->tw);
+}
+
+
+g2dAtlasImage* g2dAtlasLoad(g2dAtlas *atlas, char path[])
+{
+    g2dTexture *tex = g2dTexLoad(path, G2D_VOID);
+    g2dAtlasImage *img = g2dAtlasAddTex(atlas, tex);
+
+    g2dTexFree(&tex);
+
+    return img;
+}
+
+
+void g2dSetAtlasImage(const g2dAtlasImage *img)
+{
+    // Only images of the texture being drawn.
+    if (img == NULL || rctx.tex == NULL || img->tex != rctx.tex)
+        return;
+
+    rctx.cur_obj.crop_x = img->x;
+    rctx.cur_obj.crop_y = img->y;
+    rctx.cur_obj.crop_w = img->w;
+    rctx.cur_obj.crop_h = img->h;
+    rctx.cur_obj.scale_w = img->w * global_scale;
+    rctx.cur_obj.scale_h = img->h * global_scale;
+}
+
 /* Scissor functions */
 
 void g2dResetScissor()
@@ -1381,8 +4650,29 @@ void g2dResetScissor()
 
 void g2dSetScissor(int x, int y, int w, int h)
 {
+    _g2dFlush();
+    if (!_g2dReserve(0))
+        return;
+
     sceGuScissor(x, y, x+w, y+h);
 
+    // Objects added before in this batch are drawn with the new scissor,
+    // but were culled with the old one: keep both.
+    if (begin)
+    {
+        clip[0] = (x < clip[0] ? x : clip[0]);
+        clip[1] = (y < clip[1] ? y : clip[1]);
+        clip[2] = (x+w > clip[2] ? x+w : clip[2]);
+        clip[3] = (y+h > clip[3] ? y+h : clip[3]);
+    }
+    else
+    {
+        clip[0] = x;
+        clip[1] = y;
+        clip[2] = x+w;
+        clip[3] = y+h;
+    }
+
     scissor = true;
 }
 
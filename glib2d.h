@@ -24,6 +24,17 @@
  *     in your Makefile.
  * - You're done !
  *
+ * \section host Host build
+ *
+ * - host/ contains stand-ins for the PSPSDK headers and a CPU rasterizer
+ *     implementing the GU subset used by gLib2D.
+ * - Run "make -C host" to get libglib2d_host.a, then link
+ *     "-lpng -ljpeg -lz -lm".
+ * - After g2dFlip(), g2d_disp_buffer.data points to the last frame in the
+ *     simulated VRAM (RGBA, 512 pixels per line).
+ * - host/gurec.h gives access to the recorded display list of the last frame
+ *     (commands, draw calls, vertices and bytes used).
+ *
  * \section copyright License
  *
  * This work is licensed under the LGPLv3 License. \n
@@ -79,9 +90,26 @@ extern "C" {
  * Enable this to greatly improve performance with 2d rotations. You SHOULD use
  * PSP_MAIN_THREAD_ATTR(THREAD_ATTR_USER | THREAD_ATTR_VFPU) to avoid crashes.
  */
+/**
+ * \def USE_FAST_SINCOS
+ * \brief Choose if rotations use the built-in sine and cosine.
+ *
+ * Otherwise, sincosf() from the math library is used. The built-in version
+ * is a polynomial with an absolute error below 1e-7 for angles up to 8192
+ * radians, larger angles go to sincosf(). Ignored when USE_VFPU is defined.
+ */
+/**
+ * \def USE_STATS
+ * \brief Choose if the per-frame statistics are enabled.
+ *
+ * Otherwise, the counters and g2dGetFrameStats() are not compiled.
+ * Counting is cheap, a few additions per g2dAdd() and g2dEnd() call.
+ */
 #define USE_PNG
 #define USE_JPEG
 //#define USE_VFPU
+//#define USE_FAST_SINCOS
+#define USE_STATS
 
 /**
  * \def G2D_SCR_W
@@ -220,7 +248,14 @@ typedef enum
 } g2dFlip_Mode;
 typedef enum
 {
-    G2D_SWIZZLE = 1 /**< Recommended. Use it to speedup rendering. */
+    G2D_SWIZZLE = 1, /**< Recommended. Use it to speedup rendering. */
+    G2D_T8 = 2,      /**< 8-bit indexed texels, 256 colors palette. */
+    G2D_T4 = 4,      /**< 4-bit indexed texels, 16 colors palette. */
+    G2D_5650 = 8,    /**< 16-bit texels, no alpha. */
+    G2D_5551 = 16,   /**< 16-bit texels, 1-bit alpha. */
+    G2D_4444 = 32,   /**< 16-bit texels, 4-bit alpha. */
+    G2D_DITHER = 64, /**< 16-bit conversion with ordered dithering. */
+    G2D_DIFFUSE = 128 /**< 16-bit conversion with error diffusion. */
 } g2dTex_Mode;
 
 /**
@@ -234,6 +269,18 @@ typedef enum
 typedef int g2dAlpha;
 typedef unsigned int g2dColor;
 
+/**
+ * \struct g2dBatch
+ * \brief Recorded batch structure, see g2dBatchBegin().
+ */
+typedef struct g2dBatch g2dBatch;
+
+/**
+ * \struct g2dAtlas
+ * \brief Texture atlas structure, see g2dAtlasCreate().
+ */
+typedef struct g2dAtlas g2dAtlas;
+
 /**
  * \struct g2dTexture
  * \brief Texture structure.
@@ -247,8 +294,70 @@ typedef struct
     float ratio;        /**< Width/height ratio. */
     bool swizzled;      /**< Is the texture swizzled ? */
     g2dColor *data;     /**< Pointer to raw data. */
+    int psm;            /**< Texel format, a GU_PSM_* constant. */
+    g2dColor *clut;     /**< Palette of GU_PSM_T4 & GU_PSM_T8 textures. */
 } g2dTexture;
 
+/**
+ * \struct g2dAtlasImage
+ * \brief Image packed in an atlas page.
+ */
+typedef struct
+{
+    g2dTexture *tex;    /**< Page holding the image. */
+    int x;              /**< Position in the page. */
+    int y;
+    int w;              /**< Image size. */
+    int h;
+} g2dAtlasImage;
+
+/**
+ * \struct g2dBulk
+ * \brief Object arrays, for g2dAddRects(), g2dAddLines() & g2dAddPoints().
+ *
+ * One element per object. Except for x and y, arrays can be NULL:
+ * the current value is then used for every object.
+ */
+typedef struct
+{
+    const float *x;         /**< Coordinates on the X axis. */
+    const float *y;         /**< Coordinates on the Y axis. */
+    const float *z;         /**< Coordinates on the Z axis. */
+    const float *w;         /**< Widths (scale), for rects. */
+    const float *h;         /**< Heights (scale), for rects. */
+    const g2dColor *color;  /**< Colors. */
+    const int *crop_x;      /**< Crops, for textured rects. All four arrays */
+    const int *crop_y;      /**< are used if crop_x is not NULL. */
+    const int *crop_w;
+    const int *crop_h;
+    const float *rot;       /**< Rotations in radians, for rects. */
+} g2dBulk;
+
+#ifdef USE_STATS
+/**
+ * \struct g2dFrameStats
+ * \brief Per-frame statistics structure.
+ *
+ * Filled in by g2dFlip() for the frame it ends.
+ */
+typedef struct
+{
+    unsigned int draw_calls;    /**< Draw calls added to the display list. */
+    unsigned int objects;       /**< Objects added with g2dAdd(). */
+    unsigned int vertices;      /**< Vertices emitted. */
+    unsigned int slices;        /**< Sprites & strips from texture slicing. */
+    unsigned int state_changes; /**< GU state commands issued by g2dEnd(). */
+    unsigned int dlist_bytes;   /**< Display list size, in bytes. */
+    unsigned int dlist_segments;/**< Display list segments used. */
+    unsigned int obj_capacity;  /**< Peak object buffer capacity. */
+    unsigned int compact_batches;/**< Draw calls with 16-bit coordinates. */
+    unsigned int culled;        /**< Objects dropped, out of the scissor. */
+    unsigned int vram_hits;     /**< Textures loaded from the VRAM pool. */
+    unsigned int vram_misses;   /**< Pool textures loaded from RAM. */
+    unsigned int vram_bytes;    /**< Bytes resident in the pool. */
+} g2dFrameStats;
+#endif
+
 /**
  * \var g2d_draw_buffer
  * \brief The current draw buffer as a texture.
@@ -334,15 +443,58 @@ void g2dBeginQuads(g2dTexture *tex);
  */
 void g2dBeginPoints();
 
+/**
+ * \brief Begins mesh rendering.
+ * @param tex Pointer to a texture, pass NULL to get a colored mesh.
+ * @param cols Number of cells per row.
+ * @param rows Number of rows of cells.
+ *
+ * This function begins object rendering. Resets all properties.
+ * One g2dAdd() call per grid vertex, (cols+1)*(rows+1) calls, row by row
+ * from the up left one. Each vertex can have its own position and color:
+ * moving them deforms the texture (water, cloth...). A vertex is mapped to
+ * the texture at its place in the grid, over its crop rectangle.
+ * Shared vertices are only computed once, the cells are drawn as indexed
+ * triangle strips.
+ * The grid can't have more than 65536 vertices.
+ */
+void g2dBeginMesh(g2dTexture *tex, int cols, int rows);
+
 /**
  * \brief Ends object rendering.
  *
  * This function ends object rendering. Must be called after g2dBegin*() to add
  * objects to the display list. Automatically adapts pspgu functionnalities
- * to get the best performance possible.
+ * to get the best performance possible. Only the pspgu states which changed
+ * since the previous call are sent, see g2dInvalidateState().
+ * The pspgu color is left white, for pspgu code drawing afterwards.
  */
 void g2dEnd();
 
+/**
+ * \brief Defers batch submission to merge compatible batches.
+ * @param use true to activate, false to desactivate (by default).
+ *
+ * When activated, g2dEnd() only closes a batch. Consecutive batches using
+ * the same object type, texture, texture properties and vertex format are
+ * merged into a single draw call, sent when an incompatible batch ends,
+ * or by g2dClear(), g2dClearZ(), g2dSetScissor(), g2dInvalidateState()
+ * and g2dFlip(). Draw order is preserved.
+ */
+void g2dSetDeferred(bool use);
+
+/**
+ * \brief Forgets the pspgu state known by the library.
+ *
+ * g2dEnd() only sends the pspgu states (depth test, color, texture...) that
+ * differ from the previous batch. Call this function after using pspgu
+ * directly (intraFont...) or after modifying the pixels of a texture
+ * already drawn in the frame, to get everything sent again.
+ * Deferred batches are submitted first, call it before using pspgu too
+ * when g2dSetDeferred() is enabled.
+ */
+void g2dInvalidateState();
+
 /**
  * \brief Resets current transformation and attribution.
  *
@@ -362,18 +514,101 @@ void g2dReset();
  */
 void g2dFlip(g2dFlip_Mode mode);
 
+#ifdef USE_STATS
+/**
+ * \brief Gets the statistics of the last frame.
+ * @param stats Pointer to save the statistics.
+ *
+ * Counters are saved by g2dFlip() then reset for the next frame.
+ * Only available when USE_STATS is defined.
+ */
+void g2dGetFrameStats(g2dFrameStats *stats);
+#endif
+
+/**
+ * \brief Lets the GE render a frame while the next one is recorded.
+ * @param use true to activate, false to desactivate (by default).
+ *
+ * Applied from the next frame. When activated, g2dFlip() sends the display
+ * list and returns immediately, the next frame is recorded in another
+ * display list. g2dFlip() then only waits for the previous frame to be
+ * rendered, before displaying it. The displayed frame is one frame late.
+ */
+void g2dSetAsyncFlip(bool use);
+
+/**
+ * \brief Keeps the most drawn textures in VRAM.
+ * @param use true to activate, false to desactivate (by default).
+ *
+ * The VRAM left after the framebuffers & the depth buffer (688 KiB) is
+ * used as a texture pool. A texture drawn in 2 frames in a row is copied
+ * there by the GE, then read from VRAM instead of RAM. When the pool is
+ * full, the least recently used textures are evicted, except the ones
+ * already drawn in the frame: other textures are drawn from RAM.
+ * Textures which fit in the texture cache (8 KiB) & textures drawn by
+ * batches always stay in RAM. Desactivating empties the pool.
+ * See the vram_* counters of g2dGetFrameStats().
+ */
+void g2dSetVramPool(bool use);
+
+/**
+ * \brief Returns the largest display list size reached by a frame.
+ * @returns The size, in bytes.
+ *
+ * A frame starts with a DLIST_SIZE bytes display list (512 KiB by default),
+ * chained to new segments when it gets full. Compare with this value to
+ * right-size DLIST_SIZE (-DDLIST_SIZE=... when compiling glib2d.c).
+ */
+unsigned int g2dGetDlistHighWater();
+
 /**
  * \brief Pushes the current transformation & attribution to a new object.
  *
  * This function must be called during object rendering.
+ * Rects, points, lines (not strips) and quads which fall entirely outside
+ * the scissor, once rotated and transformed by the matrix, are dropped here.
+ * Lines and quads are tested when their last vertex is added. Nothing is
+ * dropped while recording a batch, as it can be drawn anywhere.
  */
 void g2dAdd();
 
+/**
+ * \brief Adds objects from arrays, bypassing the current object.
+ * @param bulk Pointer to the arrays.
+ * @param n Number of objects.
+ *
+ * This function must be called between g2dBeginRects() and g2dEnd().
+ * The result is the same as setting the properties given by the arrays then
+ * calling g2dAdd() for each object, but the vertices are directly written to
+ * the display list, as a draw call of their own.
+ */
+void g2dAddRects(const g2dBulk *bulk, unsigned int n);
+
+/**
+ * \brief Adds line vertices from arrays.
+ * @param bulk Pointer to the arrays. Only x, y, z & color are used.
+ * @param n Number of vertices.
+ *
+ * This function must be called between g2dBeginLines() and g2dEnd().
+ * See g2dAddRects().
+ */
+void g2dAddLines(const g2dBulk *bulk, unsigned int n);
+
+/**
+ * \brief Adds points from arrays.
+ * @param bulk Pointer to the arrays. Only x, y, z & color are used.
+ * @param n Number of points.
+ *
+ * This function must be called between g2dBeginPoints() and g2dEnd().
+ * See g2dAddRects().
+ */
+void g2dAddPoints(const g2dBulk *bulk, unsigned int n);
+
 /**
  * \brief Saves the current transformation to stack.
  *
  * This function must be called during object rendering.
- * The stack is 64 saves high.
+ * The matrix is saved too. The stack grows when needed.
  * Use it like the OpenGL one.
  */
 void g2dPush();
@@ -382,19 +617,121 @@ void g2dPush();
  * \brief Restore the current transformation from stack.
  *
  * This function must be called during object rendering.
- * The stack is 64 saves high.
+ * The matrix is restored too.
  * Use it like the OpenGL one.
  */
 void g2dPop();
 
+/**
+ * \brief Resets the current matrix to identity.
+ *
+ * The matrix transforms the objects added after it is set, after their own
+ * position, scale & rotation: use it to build hierarchies of objects.
+ * It is kept from a batch to another, and reset by g2dFlip().
+ */
+void g2dResetMatrix();
+
+/**
+ * \brief Gets the current matrix.
+ * @param m Six floats, receives {a, b, x, c, d, y}:
+ *          x' = a*x + b*y + x, y' = c*x + d*y + y.
+ *
+ * The translation is given in pixels, global scale included.
+ */
+void g2dGetMatrix(float m[6]);
+
+/**
+ * \brief Sets the current matrix.
+ * @param m Six floats {a, b, x, c, d, y}, see g2dGetMatrix().
+ */
+void g2dSetMatrix(const float m[6]);
+
+/**
+ * \brief Multiplies the current matrix by a translation.
+ * @param x Translation on the X axis, in pixels.
+ * @param y Translation on the Y axis, in pixels.
+ */
+void g2dMatrixTranslate(float x, float y);
+
+/**
+ * \brief Multiplies the current matrix by a rotation.
+ * @param degrees Angle, in degrees.
+ */
+void g2dMatrixRotate(float degrees);
+
+/**
+ * \brief Multiplies the current matrix by a rotation.
+ * @param radians Angle, in radians.
+ */
+void g2dMatrixRotateRad(float radians);
+
+/**
+ * \brief Multiplies the current matrix by a scale.
+ * @param w Factor on the X axis.
+ * @param h Factor on the Y axis.
+ *
+ * A rotation composed with a non-uniform scale skews the objects.
+ */
+void g2dMatrixScale(float w, float h);
+
+/**
+ * \brief Starts recording a batch.
+ *
+ * Every following g2dBegin*() ... g2dEnd() (and g2dClear(), g2dSetScissor())
+ * is recorded once in the batch's own display list, instead of the frame's.
+ * Can be used outside of a frame, at loading time.
+ * Static content can then be drawn each frame by g2dDrawBatch().
+ */
+void g2dBatchBegin();
+
+/**
+ * \brief Ends recording a batch.
+ * @returns A pointer to the batch, NULL if none was started.
+ */
+g2dBatch* g2dBatchEnd();
+
+/**
+ * \brief Frees a batch.
+ * @param batch Pointer to the variable which contains the batch pointer.
+ *
+ * The batch must not be used by a frame still being rendered.
+ * The batch pointer is set to NULL.
+ */
+void g2dBatchFree(g2dBatch **batch);
+
+/**
+ * \brief Draws a recorded batch.
+ * @param batch Pointer to the batch.
+ *
+ * Only adds a call to the batch's display list, its objects are not
+ * processed again.
+ */
+void g2dDrawBatch(g2dBatch *batch);
+
+/**
+ * \brief Draws a recorded batch, translated.
+ * @param batch Pointer to the batch.
+ * @param x Offset on the x axis.
+ * @param y Offset on the y axis.
+ *
+ * The GE can't translate 2D coordinates: the vertices are copied to the frame's
+ * display list with the offset applied, which costs more than g2dDrawBatch().
+ * Only the draws of the batch are sent again.
+ */
+void g2dDrawBatchXY(g2dBatch *batch, float x, float y);
+
 /**
  * \brief Creates a new blank texture.
  * @param w Width of the texture.
  * @param h Height of the texture.
+ * @param tex_mode A g2dTex_Mode constant, for the texel format.
  *
  * This function returns NULL on allocation fail.
+ * Texels are 32-bit by default. Pass G2D_5650, G2D_5551 or G2D_4444 to
+ * get 16-bit texels, G2D_T8 or G2D_T4 to get indexed texels and a blank
+ * palette in tex->clut. The texture is not swizzled.
  */
-g2dTexture* g2dTexCreate(int w, int h);
+g2dTexture* g2dTexCreate(int w, int h, g2dTex_Mode mode);
 
 /**
  * \brief Frees a texture & set its pointer to NULL.
@@ -406,19 +743,94 @@ g2dTexture* g2dTexCreate(int w, int h);
  */
 void g2dTexFree(g2dTexture **tex);
 
+/**
+ * \brief Applies changes made to the texture data.
+ * @param tex The texture.
+ *
+ * Must be called after writing to tex->data, before drawing the texture.
+ * Writes the data back from the CPU cache, and drops the VRAM copy of the
+ * texture (see g2dSetVramPool()).
+ */
+void g2dTexUpdate(g2dTexture *tex);
+
 /**
  * \brief Loads an image.
  * @param path Path to the file.
  * @param tex_mode A g2dTex_Mode constant.
  * @returns Pointer to the generated texture.
  *
- * This function loads an image file. There is support for PNG & JPEG files
- * (if USE_PNG and USE_JPEG are defined). Swizzling is enabled only for 16*16+
- * textures (useless on small textures), pass G2D_SWIZZLE to enable it.
+ * This function loads an image file. There is support for PNG, JPEG & DDS
+ * files (PNG & JPEG if USE_PNG and USE_JPEG are defined). Swizzling is enabled
+ * only for 16*16+ textures (useless on small textures), pass G2D_SWIZZLE to
+ * enable it.
  * Texture supported up to 512*512 in size only (hardware limitation).
+ *
+ * Pass G2D_T8 or G2D_T4 to get an indexed texture, 4 or 8 times smaller.
+ * Paletted PNG files are loaded as they are, when their palette fits.
+ * Other images are reduced to 256 or 16 colors (median cut).
+ *
+ * Pass G2D_5650, G2D_5551 or G2D_4444 to get a 16-bit texture, twice
+ * smaller. Add G2D_DITHER (ordered, 4*4 matrix) or G2D_DIFFUSE
+ * (Floyd-Steinberg) to dither colors against banding. Alpha is rounded.
+ *
+ * DDS files holding DXT1, DXT3 or DXT5 blocks are loaded compressed (4 or
+ * 8 bits per texel), whatever the mode. Only the first mipmap is read,
+ * compressed textures are never swizzled.
  */
 g2dTexture* g2dTexLoad(char path[], g2dTex_Mode mode);
 
+/**
+ * \brief Creates an empty texture atlas.
+ * @param swizzle Swizzles the pages, like G2D_SWIZZLE does for textures.
+ * @returns Pointer to the atlas, NULL on allocation fail.
+ *
+ * Images added to an atlas are packed into shared 512*512 pages, so that
+ * sprites of different images can be drawn in the same batch, without
+ * padding each one to a power of two. Pages are created when needed.
+ * Pages are 32-bit textures, whatever the images were loaded from.
+ */
+g2dAtlas* g2dAtlasCreate(bool swizzle);
+
+/**
+ * \brief Frees an atlas, its pages & images, and set its pointer to NULL.
+ * @param atlas Pointer to the variable which contains the atlas pointer.
+ */
+void g2dAtlasFree(g2dAtlas **atlas);
+
+/**
+ * \brief Packs an image into an atlas.
+ * @param atlas The atlas.
+ * @param data Pixels of the image.
+ * @param w Width of the image.
+ * @param h Height of the image.
+ * @param stride Pixels between two lines in data.
+ * @returns The packed image, freed with the atlas. NULL on fail.
+ *
+ * The pixels are copied. Images are placed with a skyline packer, at the
+ * lowest place of the first page with room: adding the largest images
+ * first packs better. A pixel of border, repeating the edges, is kept
+ * around each image so that linear filtering doesn't bleed. Images must
+ * be 510*510 at most.
+ */
+g2dAtlasImage* g2dAtlasAdd(g2dAtlas *atlas, const g2dColor *data,
+                           int w, int h, int stride);
+
+/**
+ * \brief Packs a texture into an atlas.
+ * @param atlas The atlas.
+ * @param tex The texture, 32-bit & not swizzled. It can be freed after.
+ * @returns The packed image, NULL on fail.
+ */
+g2dAtlasImage* g2dAtlasAddTex(g2dAtlas *atlas, const g2dTexture *tex);
+
+/**
+ * \brief Loads an image into an atlas.
+ * @param atlas The atlas.
+ * @param path Path to the file, see g2dTexLoad().
+ * @returns The packed image, NULL on fail.
+ */
+g2dAtlasImage* g2dAtlasLoad(g2dAtlas *atlas, char path[]);
+
 /**
  * \brief Resets the current coordinates.
  *
@@ -495,6 +907,19 @@ void g2dSetCoordXYZRelative(float x, float y, float z);
  */
 void g2dSetCoordInteger(bool use);
 
+/**
+ * \brief Use 16-bit vertex coordinates when possible.
+ * @param use false to always send floats, true to let integer batches
+ *            use shorts (by default).
+ *
+ * With g2dSetCoordInteger(true), a batch whose coordinates all fit in a
+ * short is sent with 16-bit vertex coordinates, which halves their size in
+ * the display list.
+ *
+ * This function must be called during object rendering.
+ */
+void g2dSetCoordCompact(bool use);
+
 /**
  * \brief Resets the global scale.
  *
@@ -667,6 +1092,18 @@ void g2dGetRotation(float *degrees);
  */
 void g2dSetRotationRad(float radians);
 
+/**
+ * \brief Sets the new rotation, by its sine and cosine.
+ * @param sin Sine of the new angle.
+ * @param cos Cosine of the new angle.
+ *
+ * This function must be called during object rendering.
+ * Skips the sine and cosine computation when they are already known,
+ * e.g. when many objects share an angle. The pair is used as is, it should
+ * be normalized to avoid scaling the object.
+ */
+void g2dSetRotationSinCos(float sin, float cos);
+
 /**
  * \brief Sets the new rotation, in degrees.
  * @param degrees The new angle.
@@ -766,6 +1203,17 @@ void g2dSetCropXYRelative(int x, int y);
  */
 void g2dSetCropWHRelative(int w, int h);
 
+/**
+ * \brief Sets the crop & the scale to an atlas image.
+ * @param img The image.
+ *
+ * This function must be called during object rendering.
+ * The image must be on the texture passed to g2dBeginRects() or
+ * g2dBeginQuads(), i.e. img->tex. Many images of a page are drawn in a
+ * single batch.
+ */
+void g2dSetAtlasImage(const g2dAtlasImage *img);
+
 /**
  * \brief Resets texture properties.
  *
@@ -0,0 +1,379 @@
+/*
+ * gLib2D - A simple, fast, light-weight 2D graphics library.
+ *
+ * Host benchmark: vertex generation.
+ * A whole g2dBegin*() ... g2dAdd() ... g2dEnd() batch is timed, i.e. from
+ * the objects to the vertex list in the display list, and the best frame
+ * is kept. The rasterization, done by g2dFlip() on host, is not, and is
+ * kept short by a 1x1 scissor. Culling and clipping are turned off, so
+ * that every object is still drawn.
+ * The corner kernels of rotated rects are then timed alone, as is the
+ * built-in sine and cosine against sincosf(). Its accuracy is checked by
+ * the host tests (test.c).
+ * Last, the fill cost of a large texture is estimated for several slice
+ * widths, from the texture cache model of the host rasterizer.
+ *
+ * Built with BENCH_BASELINE (see the Makefile), only the vertex generation
+ * is timed, against the glib2d.c and glib2d.h of an older revision, with
+ * the API they share.
+ */
+
+#include "glib2d.h"
+#include "gurec.h"
+
+#include <malloc.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define OBJ_NBR                 (10000)
+#define FRAME_NBR               (50)
+#define CORNER_OBJ_NBR          (100000)
+#define SINCOS_NBR              (1000000)
+#define FILL_TEX_W              (512)
+#define FILL_TEX_H              (256)
+#define FILL_WIDTH_NBR          (8)
+#define FILL_FORMAT_NBR         (4)
+#define LINE_FILL_CYCLES        (16)    // Assumed, 64 bytes from RAM.
+
+#ifndef BENCH_BASELINE
+// Internal kernels, see glib2d.c.
+void _g2dCornersC(unsigned int i, unsigned int n,
+                  float *c, unsigned int stride);
+#if defined(__SSE2__) || defined(__ARM_NEON)
+void _g2dCornersSimd(unsigned int i, unsigned int n,
+                     float *c, unsigned int stride);
+#endif
+void _g2dFastSinCos(float x, float *s, float *c);
+void _g2dSetSliceWidth(int w);
+int _g2dTexBits(int psm);
+void _swizzle(unsigned char *dest, unsigned char *source,
+              int width, int height);
+void _g2dSetClipping(bool use);
+void _g2dSetCulling(bool use);
+#endif
+
+typedef enum
+{
+    RECTS, RECTS_COLOR, RECTS_TEX, RECTS_TEX_ROT, RECTS_INT,
+    QUADS_TEX, LINES, POINTS, BENCH_NBR
+} Bench;
+
+static const char *names[BENCH_NBR] =
+{
+    "rects", "rects, colored", "rects, textured", "rects, textured, rotated",
+    "rects, integer", "quads, textured", "lines", "points"
+};
+
+static float xs[OBJ_NBR], ys[OBJ_NBR];
+static g2dColor colors[OBJ_NBR];
+static g2dTexture *tex;
+
+
+double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+void add(Bench b)
+{
+    int i;
+
+    switch (b)
+    {
+        case QUADS_TEX:
+            g2dBeginQuads(tex);
+            break;
+
+        case LINES:
+            g2dBeginLines(G2D_VOID);
+            break;
+
+        case POINTS:
+            g2dBeginPoints();
+            break;
+
+        case RECTS_TEX:
+        case RECTS_TEX_ROT:
+            g2dBeginRects(tex);
+            break;
+
+        default:
+            g2dBeginRects(NULL);
+            break;
+    }
+
+    if (b == RECTS_INT)
+        g2dSetCoordInteger(true);
+
+    for (i=0; i<OBJ_NBR; i++)
+    {
+        g2dSetCoordXY(xs[i], ys[i]);
+
+        if (b != RECTS && b != RECTS_TEX && b != RECTS_TEX_ROT)
+            g2dSetColor(colors[i]);
+
+        if (b == RECTS_TEX_ROT)
+            g2dSetRotation(i);
+
+        g2dAdd();
+    }
+}
+
+
+#ifndef BENCH_BASELINE
+void corners()
+{
+    float *c = memalign(16, 8 * CORNER_OBJ_NBR * sizeof(float));
+    double t, best_c = 1e9, best_simd = 1e9;
+    int f, i;
+
+    // The objects stay in the store after g2dEnd().
+    g2dClear(BLACK);
+    g2dBeginRects(NULL);
+
+    for (i=0; i<CORNER_OBJ_NBR; i++)
+    {
+        g2dSetCoordXY(rand() % G2D_SCR_W, rand() % G2D_SCR_H);
+        g2dSetRotation(i+1);
+        g2dAdd();
+    }
+
+    g2dSetScissor(0, 0, 1, 1);
+    g2dEnd();
+
+    for (f=0; f<FRAME_NBR; f++)
+    {
+        t = now();
+        _g2dCornersC(0, CORNER_OBJ_NBR, c, CORNER_OBJ_NBR);
+        t = now() - t;
+
+        if (t < best_c)
+            best_c = t;
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+        t = now();
+        _g2dCornersSimd(0, CORNER_OBJ_NBR, c, CORNER_OBJ_NBR);
+        t = now() - t;
+
+        if (t < best_simd)
+            best_simd = t;
+#endif
+    }
+
+    g2dFlip(G2D_VSYNC);
+
+    printf("%-26s %8.2f Mobjects/s\n", "corners, scalar",
+           CORNER_OBJ_NBR / best_c * 1e-6);
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    printf("%-26s %8.2f Mobjects/s\n", "corners, simd",
+           CORNER_OBJ_NBR / best_simd * 1e-6);
+#endif
+
+    free(c);
+}
+
+
+void sincos_bench()
+{
+    static float xs[SINCOS_NBR];
+    double t, best_libm = 1e9, best_fast = 1e9;
+    volatile float sink = 0.f;
+    float s, c, sum;
+    int f, i;
+
+    for (i=0; i<SINCOS_NBR; i++)
+        xs[i] = (rand() / (float)RAND_MAX - 0.5f) * 4.f * M_PI;
+
+    for (f=0; f<FRAME_NBR / 5; f++)
+    {
+        sum = 0.f;
+        t = now();
+        for (i=0; i<SINCOS_NBR; i++)
+        {
+            sincosf(xs[i], &s, &c);
+            sum += s + c;
+        }
+        t = now() - t;
+        sink += sum;
+
+        if (t < best_libm)
+            best_libm = t;
+
+        sum = 0.f;
+        t = now();
+        for (i=0; i<SINCOS_NBR; i++)
+        {
+            _g2dFastSinCos(xs[i], &s, &c);
+            sum += s + c;
+        }
+        t = now() - t;
+        sink += sum;
+
+        if (t < best_fast)
+            best_fast = t;
+    }
+
+    printf("%-26s %8.2f Mcalls/s\n", "sincos, libm",
+           SINCOS_NBR / best_libm * 1e-6);
+    printf("%-26s %8.2f Mcalls/s\n", "sincos, fast",
+           SINCOS_NBR / best_fast * 1e-6);
+}
+
+
+void fill()
+{
+    // Forced slice widths, then the adaptive one.
+    const int widths[FILL_WIDTH_NBR] = {8, 16, 32, 64, 128, 256, 512, 0};
+    const char *scenes[3] = {"1:1", "2x", "rotated"};
+    const char *formats[FILL_FORMAT_NBR] = {"8888", "5650", "T8", "T4"};
+    const g2dTex_Mode modes[FILL_FORMAT_NBR] =
+        {G2D_VOID, G2D_5650, G2D_T8, G2D_T4};
+    g2dTexture *tex[2*FILL_FORMAT_NBR];
+    const GuRecList *l;
+    unsigned char *data;
+    int bytes, s, sc, w, i;
+    char name[32];
+
+    // Each format linear, then swizzled.
+    for (s=0; s<2*FILL_FORMAT_NBR; s+=2)
+    {
+        tex[s] = g2dTexCreate(FILL_TEX_W, FILL_TEX_H, modes[s/2]);
+        tex[s+1] = g2dTexCreate(FILL_TEX_W, FILL_TEX_H, modes[s/2]);
+        bytes = FILL_TEX_W * _g2dTexBits(tex[s]->psm) / 8;
+        data = (unsigned char*)tex[s]->data;
+
+        for (i=0; i<bytes*FILL_TEX_H; i++)
+            data[i] = rand();
+
+        _swizzle((unsigned char*)tex[s+1]->data, data, bytes, FILL_TEX_H);
+        tex[s+1]->swizzled = true;
+    }
+
+    printf("%-26s", "fill, cycles/pixel");
+    for (w=0; w<FILL_WIDTH_NBR; w++)
+    {
+        if (widths[w] > 0)
+            printf(" %6d", widths[w]);
+        else
+            printf(" %6s", "adapt.");
+    }
+    printf("\n");
+
+    for (s=0; s<2*FILL_FORMAT_NBR; s++)
+    {
+        for (sc=0; sc<3; sc++)
+        {
+            sprintf(name, "%s%s, %s", formats[s/2], s%2 ? " swz." : "",
+                    scenes[sc]);
+            printf("%-26s", name);
+
+            for (w=0; w<FILL_WIDTH_NBR; w++)
+            {
+                _g2dSetSliceWidth(widths[w]);
+
+                g2dClear(BLACK);
+                g2dBeginRects(tex[s]);
+
+                if (sc == 1) // Magnified, each texel row is read twice.
+                {
+                    g2dSetCropWH(G2D_SCR_W/2, G2D_SCR_H/2);
+                    g2dSetScaleWH(G2D_SCR_W, G2D_SCR_H);
+                }
+                else if (sc == 2) // Rows are crossed by each scanline.
+                {
+                    g2dSetCoordMode(G2D_CENTER);
+                    g2dSetCoordXY(G2D_SCR_W/2, G2D_SCR_H/2);
+                    g2dSetRotation(30.f);
+                }
+
+                g2dAdd();
+                g2dEnd();
+                g2dFlip(G2D_VSYNC);
+
+                l = guRecLastList();
+                printf(" %6.2f", (l->pixels + l->tex_misses *
+                                  LINE_FILL_CYCLES) / (float)l->pixels);
+            }
+
+            printf("\n");
+        }
+    }
+
+    _g2dSetSliceWidth(0);
+
+    for (s=0; s<2*FILL_FORMAT_NBR; s++)
+        g2dTexFree(&tex[s]);
+}
+#endif
+
+
+int main()
+{
+    double t, best;
+    int b, f, i;
+
+    srand(1);
+
+    for (i=0; i<OBJ_NBR; i++)
+    {
+        xs[i] = rand() % G2D_SCR_W;
+        ys[i] = rand() % G2D_SCR_H;
+        colors[i] = rand() | 0xFF000000;
+    }
+
+#ifdef BENCH_BASELINE
+    tex = g2dTexCreate(32, 32);
+#else
+    tex = g2dTexCreate(32, 32, G2D_VOID);
+
+    _g2dSetCulling(false);
+    _g2dSetClipping(false);
+#endif
+
+    // Objects, not vertices: their number depends on the revision.
+    for (b=0; b<BENCH_NBR; b++)
+    {
+        best = 1e9;
+
+        for (f=0; f<FRAME_NBR; f++)
+        {
+            g2dClear(BLACK);
+            g2dSetScissor(0, 0, 1, 1);
+
+            t = now();
+            add(b);
+            g2dEnd();
+            t = now() - t;
+
+            if (t < best)
+                best = t;
+
+            g2dFlip(G2D_VSYNC);
+        }
+
+        printf("%-26s %8.2f Mobjects/s\n", names[b], OBJ_NBR / best * 1e-6);
+    }
+
+#ifndef BENCH_BASELINE
+    _g2dSetCulling(true);
+    _g2dSetClipping(true);
+
+    corners();
+    sincos_bench();
+    fill();
+#endif
+
+    g2dTexFree(&tex);
+    g2dTerm();
+
+    return 0;
+}
+
+// EOF
@@ -0,0 +1,1118 @@
+/*
+ * gLib2D - A simple, fast, light-weight 2D graphics library.
+ *
+ * Copyright 2012 Clément Guérin <geecko.dev@free.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host backend: CPU rasterizer, executes the recorded GU commands.
+ * Only GU_TRANSFORM_2D vertices are supported, which is all gLib2D emits.
+ * Texel reads go through a model of the GE texture cache, to estimate the
+ * fill cost of a list: only the line fills are counted, the texels are
+ * always read from the texture itself.
+ */
+
+#include "pspkernel.h"
+#include "pspgu.h"
+#include "vram.h"
+#include "ge.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+/* Defines */
+
+#define DEFAULT_FB_H            (272)
+#define TEX_CACHE_LINE          (64)
+#define TEX_CACHE_WAYS          (2)
+#define TEX_CACHE_SETS          (8192/TEX_CACHE_LINE/TEX_CACHE_WAYS)
+
+#define GET_R(color)            (((color)      ) & 0xFF)
+#define GET_G(color)            (((color) >>  8) & 0xFF)
+#define GET_B(color)            (((color) >> 16) & 0xFF)
+#define GET_A(color)            (((color) >> 24) & 0xFF)
+#define RGBA(r, g, b, a)        ((r)|((g)<<8)|((b)<<16)|((unsigned int)(a)<<24))
+
+/* Structures */
+
+typedef struct
+{
+    float u, v;
+    unsigned int color;
+    float x, y, z;
+} Vertex;
+
+typedef struct
+{
+    int size;
+    int tex_fmt, tex_off;
+    int color_fmt, color_off;
+    int pos_fmt, pos_off;
+    int index_fmt;
+} VertexLayout;
+
+typedef struct
+{
+    unsigned int states;
+    unsigned int color;
+    unsigned int clear_color;
+    unsigned int clear_depth;
+    int shade_model;
+
+    // Buffers, as VRAM relative pointers
+    void *draw_rel, *depth_rel;
+    int draw_fbw, depth_fbw;
+    int fb_w, fb_h;
+    int off_x, off_y;
+    int sc_x0, sc_y0, sc_x1, sc_y1;
+
+    // Tests & blending
+    int alpha_func, alpha_ref, alpha_mask;
+    int depth_func;
+    int blend_op, blend_src, blend_dst;
+    unsigned int blend_srcfix, blend_dstfix;
+
+    // Texture
+    int tfx, tcc;
+    int tex_min, tex_mag;
+    int tex_wrap_u, tex_wrap_v;
+    int tex_psm, tex_swizzle;
+    int tex_w, tex_h, tex_tbw;
+    const u8 *tex_data;
+
+    // Palette, copied from memory by sceGuClutLoad().
+    int clut_psm, clut_shift, clut_mask, clut_start;
+    u32 clut[256];
+} GeState;
+
+/* Local variables */
+
+static u32 vram[HOST_VRAM_SIZE/4] __attribute__((aligned(16)));
+
+static GeState ge;
+static GeCounters counters;
+
+// Tags of the lines in the texture cache, most recently used way first.
+static size_t tex_cache[TEX_CACHE_SETS][TEX_CACHE_WAYS];
+
+/* VRAM */
+
+void* vrelptr(void *ptr)
+{
+    return (void*)((u8*)ptr - (u8*)vram);
+}
+
+
+void* vabsptr(void *ptr)
+{
+    return (void*)((u8*)vram + (size_t)ptr);
+}
+
+/* Pixel pipeline */
+
+bool _geTest(int func, int a, int b)
+{
+    switch (func)
+    {
+        case GU_NEVER:    return false;
+        case GU_EQUAL:    return a == b;
+        case GU_NOTEQUAL: return a != b;
+        case GU_LESS:     return a <  b;
+        case GU_LEQUAL:   return a <= b;
+        case GU_GREATER:  return a >  b;
+        case GU_GEQUAL:   return a >= b;
+        case GU_ALWAYS:
+        default:          return true;
+    }
+}
+
+
+void _geClipRect(int *x0, int *y0, int *x1, int *y1)
+{
+    *x0 = 0;
+    *y0 = 0;
+    *x1 = (ge.fb_w > 0 && ge.fb_w < ge.draw_fbw ? ge.fb_w : ge.draw_fbw);
+    *y1 = ge.fb_h;
+
+    if (ge.states & (1 << GU_SCISSOR_TEST))
+    {
+        if (ge.sc_x0 > *x0) *x0 = ge.sc_x0;
+        if (ge.sc_y0 > *y0) *y0 = ge.sc_y0;
+        if (ge.sc_x1 < *x1) *x1 = ge.sc_x1;
+        if (ge.sc_y1 < *y1) *y1 = ge.sc_y1;
+    }
+}
+
+
+unsigned int _geTexOffset(int x, int y, int bits)
+{
+    unsigned int row = ge.tex_tbw * bits / 8;
+    unsigned int xb = x * bits / 8;
+
+    if (!ge.tex_swizzle)
+        return y * row + xb;
+
+    // 16 bytes * 8 lines blocks, see _swizzle() in glib2d.c.
+    return ((y >> 3) * (row >> 4) + (xb >> 4)) * 128 +
+           ((y & 7) << 4) + (xb & 15);
+}
+
+
+int _geWrap(int c, int size, int mode)
+{
+    if (mode == GU_REPEAT)
+        return ((c % size) + size) % size;
+
+    if (c < 0)     return 0;
+    if (c >= size) return size - 1;
+    return c;
+}
+
+
+void _geTexCacheFlush()
+{
+    memset(tex_cache, 0, sizeof(tex_cache));
+}
+
+
+void _geTexCacheRead(const u8 *p)
+{
+    // Tag 0 is an empty line.
+    size_t tag = (size_t)p / TEX_CACHE_LINE + 1;
+    size_t *set = tex_cache[tag % TEX_CACHE_SETS];
+    int i;
+
+    counters.tex_reads++;
+
+    for (i=0; i<TEX_CACHE_WAYS && set[i] != tag; i++);
+
+    if (i == TEX_CACHE_WAYS) // Line fill, the least recently used goes.
+    {
+        counters.tex_misses++;
+        i = TEX_CACHE_WAYS-1;
+    }
+
+    for (; i>0; i--)
+        set[i] = set[i-1];
+
+    set[0] = tag;
+}
+
+
+int _geTexBits(int psm)
+{
+    // 5650, 5551, 4444, 8888, T4, T8, T16, T32, DXT1, DXT3, DXT5
+    static const int bits[] = {16, 16, 16, 32, 4, 8, 16, 32, 4, 8, 8};
+
+    return bits[psm];
+}
+
+
+unsigned int _geClut(unsigned int index)
+{
+    return ge.clut[((index >> ge.clut_shift) & ge.clut_mask) |
+                   (ge.clut_start << 4)];
+}
+
+
+unsigned int _geExpand(unsigned int v, int bits)
+{
+    // Bit replication.
+    v &= (1 << bits) - 1;
+
+    if (bits == 1)
+        return v ? 0xFF : 0;
+
+    return (v << (8 - bits)) | (v >> (2*bits - 8));
+}
+
+
+unsigned int _geDXT(const u8 *p, int i)
+{
+    // Blocks as read by the GE: color indices, RGB565 endpoints (red in the
+    // high bits, unlike GU_PSM_5650 texels), then alpha.
+    unsigned int c0 = p[4] | (p[5] << 8), c1 = p[6] | (p[7] << 8);
+    unsigned int code = (*(const u32*)p >> (2*i)) & 3;
+    unsigned int e[2][3], color = 0, a = 0xFF;
+    unsigned long long bits;
+    int k, a0, a1;
+
+    for (k=0; k<2; k++)
+    {
+        e[k][0] = _geExpand((k ? c1 : c0) >> 11, 5);
+        e[k][1] = _geExpand((k ? c1 : c0) >> 5, 6);
+        e[k][2] = _geExpand((k ? c1 : c0), 5);
+    }
+
+    for (k=0; k<3; k++)
+    {
+        if (code < 2)
+            color |= e[code][k] << (k*8);
+        else if (c0 > c1 || ge.tex_psm != GU_PSM_DXT1)
+            color |= ((code == 2 ? 2 : 1) * e[0][k] +
+                      (code == 2 ? 1 : 2) * e[1][k]) / 3 << (k*8);
+        else if (code == 2)
+            color |= (e[0][k] + e[1][k]) / 2 << (k*8);
+        else
+            a = 0;
+    }
+
+    if (ge.tex_psm == GU_PSM_DXT3)
+    {
+        a = _geExpand(*(const u16*)(p + 8 + 2*(i/4)) >> (4*(i%4)), 4);
+    }
+    else if (ge.tex_psm == GU_PSM_DXT5)
+    {
+        a0 = p[14];
+        a1 = p[15];
+        bits = *(const u32*)(p + 8) |
+               (unsigned long long)*(const u16*)(p + 12) << 32;
+        code = (bits >> (3*i)) & 7;
+
+        if (code < 2)
+            a = (code ? a1 : a0);
+        else if (a0 > a1)
+            a = ((8-code) * a0 + (code-1) * a1) / 7;
+        else if (code < 6)
+            a = ((6-code) * a0 + (code-1) * a1) / 5;
+        else
+            a = (code == 6 ? 0 : 0xFF);
+    }
+
+    return RGBA(GET_R(color), GET_G(color), GET_B(color), a);
+}
+
+
+unsigned int _geTexel(int x, int y)
+{
+    int bits = _geTexBits(ge.tex_psm);
+    const u8 *p;
+
+    x = _geWrap(x, ge.tex_w, ge.tex_wrap_u);
+    y = _geWrap(y, ge.tex_h, ge.tex_wrap_v);
+
+    // Compressed textures are rows of 4*4 texels blocks.
+    if (ge.tex_psm >= GU_PSM_DXT1)
+    {
+        p = ge.tex_data + ((y/4) * (ge.tex_tbw/4) + x/4) * bits * 2;
+        _geTexCacheRead(p);
+
+        return _geDXT(p, (y%4)*4 + x%4);
+    }
+
+    p = ge.tex_data + _geTexOffset(x, y, bits);
+
+    _geTexCacheRead(p);
+
+    switch (ge.tex_psm)
+    {
+        case GU_PSM_5650:
+            return RGBA(_geExpand(*(const u16*)p, 5),
+                        _geExpand(*(const u16*)p >> 5, 6),
+                        _geExpand(*(const u16*)p >> 11, 5), 0xFF);
+
+        case GU_PSM_5551:
+            return RGBA(_geExpand(*(const u16*)p, 5),
+                        _geExpand(*(const u16*)p >> 5, 5),
+                        _geExpand(*(const u16*)p >> 10, 5),
+                        _geExpand(*(const u16*)p >> 15, 1));
+
+        case GU_PSM_4444:
+            return RGBA(_geExpand(*(const u16*)p, 4),
+                        _geExpand(*(const u16*)p >> 4, 4),
+                        _geExpand(*(const u16*)p >> 8, 4),
+                        _geExpand(*(const u16*)p >> 12, 4));
+
+        case GU_PSM_T4: // Even texels in the low nibble.
+            return _geClut((*p >> ((x & 1) * 4)) & 0xF);
+
+        case GU_PSM_T8:
+            return _geClut(*p);
+
+        default:
+            return *(const u32*)p;
+    }
+}
+
+
+unsigned int _geSample(float u, float v)
+{
+    unsigned int t[4];
+    unsigned int out = 0;
+    float fx, fy;
+    int x, y, i;
+
+    if (ge.tex_mag == GU_NEAREST)
+        return _geTexel((int)floorf(u), (int)floorf(v));
+
+    u -= 0.5f;
+    v -= 0.5f;
+    x = (int)floorf(u);
+    y = (int)floorf(v);
+    fx = u - x;
+    fy = v - y;
+
+    t[0] = _geTexel(x  , y  );
+    t[1] = _geTexel(x+1, y  );
+    t[2] = _geTexel(x  , y+1);
+    t[3] = _geTexel(x+1, y+1);
+
+    for (i=0; i<32; i+=8)
+    {
+        float c0 = ((t[0] >> i) & 0xFF) * (1.f-fx) + ((t[1] >> i) & 0xFF) * fx;
+        float c1 = ((t[2] >> i) & 0xFF) * (1.f-fx) + ((t[3] >> i) & 0xFF) * fx;
+
+        out |= (unsigned int)(c0 * (1.f-fy) + c1 * fy + 0.5f) << i;
+    }
+
+    return out;
+}
+
+
+unsigned int _geTexFunc(unsigned int t, unsigned int c)
+{
+    unsigned int r, g, b, a;
+
+    a = (ge.tcc == GU_TCC_RGBA ? GET_A(t) * GET_A(c) / 255 : GET_A(c));
+
+    switch (ge.tfx)
+    {
+        case GU_TFX_REPLACE:
+            r = GET_R(t);
+            g = GET_G(t);
+            b = GET_B(t);
+            if (ge.tcc == GU_TCC_RGBA) a = GET_A(t);
+            break;
+
+        case GU_TFX_DECAL:
+            r = (GET_R(t) * GET_A(t) + GET_R(c) * (255 - GET_A(t))) / 255;
+            g = (GET_G(t) * GET_A(t) + GET_G(c) * (255 - GET_A(t))) / 255;
+            b = (GET_B(t) * GET_A(t) + GET_B(c) * (255 - GET_A(t))) / 255;
+            a = GET_A(c);
+            break;
+
+        case GU_TFX_ADD:
+            r = GET_R(t) + GET_R(c); if (r > 255) r = 255;
+            g = GET_G(t) + GET_G(c); if (g > 255) g = 255;
+            b = GET_B(t) + GET_B(c); if (b > 255) b = 255;
+            break;
+
+        case GU_TFX_MODULATE:
+        default:
+            r = GET_R(t) * GET_R(c) / 255;
+            g = GET_G(t) * GET_G(c) / 255;
+            b = GET_B(t) * GET_B(c) / 255;
+            break;
+    }
+
+    return RGBA(r, g, b, a);
+}
+
+
+int _geBlendFactor(int factor, unsigned int fix, unsigned int other,
+                   unsigned int src, unsigned int dst, int shift)
+{
+    switch (factor)
+    {
+        case 0:  return (other >> shift) & 0xFF;
+        case 1:  return 255 - ((other >> shift) & 0xFF);
+        case GU_SRC_ALPHA:           return GET_A(src);
+        case GU_ONE_MINUS_SRC_ALPHA: return 255 - GET_A(src);
+        case GU_DST_ALPHA:           return GET_A(dst);
+        case GU_ONE_MINUS_DST_ALPHA: return 255 - GET_A(dst);
+        case GU_FIX:
+        default:                     return (fix >> shift) & 0xFF;
+    }
+}
+
+
+unsigned int _geBlend(unsigned int src, unsigned int dst)
+{
+    unsigned int out = 0;
+    int i;
+
+    for (i=0; i<32; i+=8)
+    {
+        int s = (src >> i) & 0xFF;
+        int d = (dst >> i) & 0xFF;
+        int sf = _geBlendFactor(ge.blend_src, ge.blend_srcfix, dst, src, dst, i);
+        int df = _geBlendFactor(ge.blend_dst, ge.blend_dstfix, src, src, dst, i);
+        int c;
+
+        switch (ge.blend_op)
+        {
+            case GU_SUBTRACT:         c = (s*sf - d*df) / 255; break;
+            case GU_REVERSE_SUBTRACT: c = (d*df - s*sf) / 255; break;
+            case GU_MIN:              c = (s < d ? s : d);     break;
+            case GU_MAX:              c = (s > d ? s : d);     break;
+            case GU_ABS:              c = abs(s - d);          break;
+            case GU_ADD:
+            default:                  c = (s*sf + d*df) / 255; break;
+        }
+
+        if (c < 0)   c = 0;
+        if (c > 255) c = 255;
+
+        out |= (unsigned int)c << i;
+    }
+
+    return out;
+}
+
+
+void _geFragment(int x, int y, float z, unsigned int color, float u, float v)
+{
+    u32 *fb = (u32*)vabsptr(ge.draw_rel);
+    u32 *px = &fb[x + y * ge.draw_fbw];
+
+    counters.pixels++;
+
+    if ((ge.states & (1 << GU_TEXTURE_2D)) && ge.tex_data != NULL)
+        color = _geTexFunc(_geSample(u, v), color);
+
+    if (ge.states & (1 << GU_ALPHA_TEST))
+    {
+        if (!_geTest(ge.alpha_func, GET_A(color) & ge.alpha_mask,
+                     ge.alpha_ref & ge.alpha_mask))
+            return;
+    }
+
+    if (ge.states & (1 << GU_DEPTH_TEST))
+    {
+        u16 *zb = (u16*)vabsptr(ge.depth_rel);
+        u16 *pz = &zb[x + y * ge.depth_fbw];
+        int iz = (int)z;
+
+        if (iz < 0)     iz = 0;
+        if (iz > 65535) iz = 65535;
+
+        if (!_geTest(ge.depth_func, iz, *pz))
+            return;
+
+        *pz = iz;
+    }
+
+    if (ge.states & (1 << GU_BLEND))
+        color = _geBlend(color, *px);
+
+    *px = color;
+}
+
+/* Rasterization */
+
+unsigned int _geLerpColor(unsigned int c0, unsigned int c1, float t)
+{
+    unsigned int out = 0;
+    int i;
+
+    for (i=0; i<32; i+=8)
+    {
+        float a = (c0 >> i) & 0xFF;
+        float b = (c1 >> i) & 0xFF;
+
+        out |= (unsigned int)(a + (b - a) * t + 0.5f) << i;
+    }
+
+    return out;
+}
+
+
+void _geDrawPoint(const Vertex *v)
+{
+    int x0, y0, x1, y1;
+    int x = (int)floorf(v->x);
+    int y = (int)floorf(v->y);
+
+    _geClipRect(&x0, &y0, &x1, &y1);
+
+    if (x < x0 || x >= x1 || y < y0 || y >= y1)
+        return;
+
+    _geFragment(x, y, v->z, v->color, v->u, v->v);
+}
+
+
+void _geDrawLine(const Vertex *a, const Vertex *b)
+{
+    int x0, y0, x1, y1;
+    float dx = b->x - a->x;
+    float dy = b->y - a->y;
+    int steps = (int)(fabsf(dx) > fabsf(dy) ? fabsf(dx) : fabsf(dy));
+    int i;
+
+    _geClipRect(&x0, &y0, &x1, &y1);
+
+    // The last pixel is not drawn, so line strips don't blend it twice.
+    for (i=0; i<steps || (steps == 0 && i == 0); i++)
+    {
+        float t = (steps == 0 ? 0.f : (float)i / steps);
+        int x = (int)floorf(a->x + dx * t);
+        int y = (int)floorf(a->y + dy * t);
+        unsigned int c = (ge.shade_model == GU_SMOOTH ?
+                          _geLerpColor(a->color, b->color, t) : b->color);
+
+        if (x < x0 || x >= x1 || y < y0 || y >= y1)
+            continue;
+
+        _geFragment(x, y, a->z + (b->z - a->z) * t, c,
+                    a->u + (b->u - a->u) * t, a->v + (b->v - a->v) * t);
+    }
+}
+
+
+void _geDrawSprite(const Vertex *a, const Vertex *b)
+{
+    int x0, y0, x1, y1;
+    int px0, py0, px1, py1;
+    float w = b->x - a->x;
+    float h = b->y - a->y;
+    int x, y;
+
+    if (w == 0.f || h == 0.f)
+        return;
+
+    _geClipRect(&x0, &y0, &x1, &y1);
+
+    // Pixel centers inside the rectangle.
+    px0 = (int)ceilf((a->x < b->x ? a->x : b->x) - 0.5f);
+    px1 = (int)ceilf((a->x < b->x ? b->x : a->x) - 0.5f);
+    py0 = (int)ceilf((a->y < b->y ? a->y : b->y) - 0.5f);
+    py1 = (int)ceilf((a->y < b->y ? b->y : a->y) - 0.5f);
+
+    if (px0 < x0) px0 = x0;
+    if (py0 < y0) py0 = y0;
+    if (px1 > x1) px1 = x1;
+    if (py1 > y1) py1 = y1;
+
+    // Sprites are flat shaded with the second vertex.
+    for (y=py0; y<py1; y++)
+    {
+        float v = a->v + (b->v - a->v) * ((y + 0.5f - a->y) / h);
+
+        for (x=px0; x<px1; x++)
+        {
+            float u = a->u + (b->u - a->u) * ((x + 0.5f - a->x) / w);
+
+            _geFragment(x, y, b->z, b->color, u, v);
+        }
+    }
+}
+
+
+float _geEdge(const Vertex *a, const Vertex *b, float x, float y)
+{
+    return (b->x - a->x) * (y - a->y) - (b->y - a->y) * (x - a->x);
+}
+
+
+bool _geTopLeft(const Vertex *a, const Vertex *b)
+{
+    float dx = b->x - a->x;
+    float dy = b->y - a->y;
+
+    return (dy == 0.f && dx > 0.f) || dy < 0.f;
+}
+
+
+void _geDrawTriangle(const Vertex *v0, const Vertex *v1, const Vertex *v2)
+{
+    int x0, y0, x1, y1;
+    int px0, py0, px1, py1;
+    float area = _geEdge(v0, v1, v2->x, v2->y);
+    bool tl0, tl1, tl2;
+    int x, y, i;
+
+    if (area == 0.f)
+        return;
+
+    // Culling is disabled, make the winding consistent.
+    if (area < 0.f)
+    {
+        const Vertex *tmp = v1;
+        v1 = v2;
+        v2 = tmp;
+        area = -area;
+    }
+
+    tl0 = _geTopLeft(v1, v2);
+    tl1 = _geTopLeft(v2, v0);
+    tl2 = _geTopLeft(v0, v1);
+
+    _geClipRect(&x0, &y0, &x1, &y1);
+
+    px0 = (int)floorf(fminf(v0->x, fminf(v1->x, v2->x)));
+    py0 = (int)floorf(fminf(v0->y, fminf(v1->y, v2->y)));
+    px1 = (int)ceilf(fmaxf(v0->x, fmaxf(v1->x, v2->x)));
+    py1 = (int)ceilf(fmaxf(v0->y, fmaxf(v1->y, v2->y)));
+
+    if (px0 < x0) px0 = x0;
+    if (py0 < y0) py0 = y0;
+    if (px1 > x1) px1 = x1;
+    if (py1 > y1) py1 = y1;
+
+    for (y=py0; y<py1; y++)
+    {
+        for (x=px0; x<px1; x++)
+        {
+            float cx = x + 0.5f;
+            float cy = y + 0.5f;
+            float w0 = _geEdge(v1, v2, cx, cy);
+            float w1 = _geEdge(v2, v0, cx, cy);
+            float w2 = _geEdge(v0, v1, cx, cy);
+            unsigned int c;
+
+            if (w0 < 0.f || (w0 == 0.f && !tl0)) continue;
+            if (w1 < 0.f || (w1 == 0.f && !tl1)) continue;
+            if (w2 < 0.f || (w2 == 0.f && !tl2)) continue;
+
+            w0 /= area;
+            w1 /= area;
+            w2 /= area;
+
+            if (ge.shade_model == GU_SMOOTH)
+            {
+                c = 0;
+
+                for (i=0; i<32; i+=8)
+                {
+                    float f = ((v0->color >> i) & 0xFF) * w0 +
+                              ((v1->color >> i) & 0xFF) * w1 +
+                              ((v2->color >> i) & 0xFF) * w2;
+
+                    c |= (unsigned int)(f + 0.5f) << i;
+                }
+            }
+            else
+                c = v2->color;
+
+            _geFragment(x, y,
+                        v0->z * w0 + v1->z * w1 + v2->z * w2, c,
+                        v0->u * w0 + v1->u * w1 + v2->u * w2,
+                        v0->v * w0 + v1->v * w1 + v2->v * w2);
+        }
+    }
+}
+
+/* Vertex decoding */
+
+int _geAlign(int offset, int align)
+{
+    return (offset + align - 1) & ~(align - 1);
+}
+
+
+void _geLayout(int vtype, VertexLayout *l)
+{
+    static const int tex_sizes[4] = {0, 1, 2, 4};
+    static const int color_sizes[8] = {0, 0, 0, 0, 2, 2, 2, 4};
+    int align = 1;
+    int size = 0;
+    int s;
+
+    l->tex_fmt = vtype & GU_TEXTURE_BITS;
+    l->color_fmt = vtype & GU_COLOR_BITS;
+    l->pos_fmt = vtype & GU_VERTEX_BITS;
+    l->index_fmt = vtype & GU_INDEX_BITS;
+
+    // Each component is aligned on its own size: [uv] [color] [normal] [xyz]
+    s = tex_sizes[l->tex_fmt];
+    if (s)
+    {
+        size = _geAlign(size, s);
+        l->tex_off = size;
+        size += 2 * s;
+        if (s > align) align = s;
+    }
+
+    s = color_sizes[l->color_fmt >> 2];
+    if (s)
+    {
+        size = _geAlign(size, s);
+        l->color_off = size;
+        size += s;
+        if (s > align) align = s;
+    }
+
+    s = tex_sizes[(vtype & GU_NORMAL_BITS) >> 5];
+    if (s)
+    {
+        size = _geAlign(size, s);
+        size += 3 * s;
+        if (s > align) align = s;
+    }
+
+    s = tex_sizes[l->pos_fmt >> 7];
+    size = _geAlign(size, s);
+    l->pos_off = size;
+    size += 3 * s;
+    if (s > align) align = s;
+
+    l->size = _geAlign(size, align);
+}
+
+
+unsigned int _geDecodeColor(const u8 *p, int fmt)
+{
+    unsigned int c = (fmt == GU_COLOR_8888 ? *(const u32*)p : *(const u16*)p);
+    unsigned int r, g, b, a;
+
+    switch (fmt)
+    {
+        case GU_COLOR_5650:
+            r = (c & 0x1F) << 3;
+            g = ((c >> 5) & 0x3F) << 2;
+            b = ((c >> 11) & 0x1F) << 3;
+            a = 0xFF;
+            return RGBA(r | r >> 5, g | g >> 6, b | b >> 5, a);
+
+        case GU_COLOR_5551:
+            r = (c & 0x1F) << 3;
+            g = ((c >> 5) & 0x1F) << 3;
+            b = ((c >> 10) & 0x1F) << 3;
+            a = (c & 0x8000 ? 0xFF : 0);
+            return RGBA(r | r >> 5, g | g >> 5, b | b >> 5, a);
+
+        case GU_COLOR_4444:
+            r = c & 0xF;
+            g = (c >> 4) & 0xF;
+            b = (c >> 8) & 0xF;
+            a = (c >> 12) & 0xF;
+            return RGBA(r * 17, g * 17, b * 17, a * 17);
+
+        case GU_COLOR_8888:
+        default:
+            return c;
+    }
+}
+
+
+float _geDecodeScalar(const u8 *p, int i, int size, bool is_unsigned)
+{
+    switch (size)
+    {
+        case 1:  return is_unsigned ? (float)p[i] : (float)((const s8*)p)[i];
+        case 2:  return is_unsigned ? (float)((const u16*)p)[i] :
+                                      (float)((const s16*)p)[i];
+        default: return ((const float*)p)[i];
+    }
+}
+
+
+void _geFetch(const VertexLayout *l, const void *vertices, const void *indices,
+              int n, Vertex *v)
+{
+    static const int sizes[4] = {0, 1, 2, 4};
+    const u8 *p;
+    int i = n;
+
+    if (indices != NULL && l->index_fmt == GU_INDEX_8BIT)
+        i = ((const u8*)indices)[n];
+    else if (indices != NULL && l->index_fmt == GU_INDEX_16BIT)
+        i = ((const u16*)indices)[n];
+
+    p = (const u8*)vertices + i * l->size;
+
+    v->u = v->v = 0.f;
+    if (l->tex_fmt)
+    {
+        int s = sizes[l->tex_fmt];
+
+        v->u = _geDecodeScalar(p + l->tex_off, 0, s, true);
+        v->v = _geDecodeScalar(p + l->tex_off, 1, s, true);
+    }
+
+    v->color = ge.color;
+    if (l->color_fmt)
+        v->color = _geDecodeColor(p + l->color_off, l->color_fmt);
+
+    v->x = _geDecodeScalar(p + l->pos_off, 0, sizes[l->pos_fmt >> 7], false);
+    v->y = _geDecodeScalar(p + l->pos_off, 1, sizes[l->pos_fmt >> 7], false);
+    v->z = _geDecodeScalar(p + l->pos_off, 2, sizes[l->pos_fmt >> 7], true);
+}
+
+
+void _geDrawArray(int prim, int vtype, int count,
+                  const void *indices, const void *vertices)
+{
+    VertexLayout l;
+    Vertex v[3];
+    int i;
+
+    if (vertices == NULL || ge.draw_fbw == 0)
+        return;
+
+    _geLayout(vtype, &l);
+
+    switch (prim)
+    {
+        case GU_POINTS:
+            for (i=0; i<count; i++)
+            {
+                _geFetch(&l, vertices, indices, i, &v[0]);
+                _geDrawPoint(&v[0]);
+            }
+            break;
+
+        case GU_LINES:
+        case GU_LINE_STRIP:
+            for (i=1; i<count; i+=(prim == GU_LINES ? 2 : 1))
+            {
+                _geFetch(&l, vertices, indices, i-1, &v[0]);
+                _geFetch(&l, vertices, indices, i  , &v[1]);
+                _geDrawLine(&v[0], &v[1]);
+            }
+            break;
+
+        case GU_TRIANGLES:
+            for (i=2; i<count; i+=3)
+            {
+                _geFetch(&l, vertices, indices, i-2, &v[0]);
+                _geFetch(&l, vertices, indices, i-1, &v[1]);
+                _geFetch(&l, vertices, indices, i  , &v[2]);
+                _geDrawTriangle(&v[0], &v[1], &v[2]);
+            }
+            break;
+
+        case GU_TRIANGLE_STRIP:
+        case GU_TRIANGLE_FAN:
+            for (i=2; i<count; i++)
+            {
+                _geFetch(&l, vertices, indices,
+                         (prim == GU_TRIANGLE_FAN ? 0 : i-2), &v[0]);
+                _geFetch(&l, vertices, indices, i-1, &v[1]);
+                _geFetch(&l, vertices, indices, i  , &v[2]);
+                _geDrawTriangle(&v[0], &v[1], &v[2]);
+            }
+            break;
+
+        case GU_SPRITES:
+            for (i=1; i<count; i+=2)
+            {
+                _geFetch(&l, vertices, indices, i-1, &v[0]);
+                _geFetch(&l, vertices, indices, i  , &v[1]);
+                _geDrawSprite(&v[0], &v[1]);
+            }
+            break;
+    }
+}
+
+
+void _geClear(int flags)
+{
+    int x0, y0, x1, y1;
+    int x, y;
+
+    _geClipRect(&x0, &y0, &x1, &y1);
+
+    for (y=y0; y<y1; y++)
+    {
+        if (flags & GU_COLOR_BUFFER_BIT)
+        {
+            u32 *fb = (u32*)vabsptr(ge.draw_rel) + y * ge.draw_fbw;
+
+            for (x=x0; x<x1; x++)
+                fb[x] = ge.clear_color;
+        }
+
+        if ((flags & GU_DEPTH_BUFFER_BIT) && ge.depth_fbw != 0)
+        {
+            u16 *zb = (u16*)vabsptr(ge.depth_rel) + y * ge.depth_fbw;
+
+            for (x=x0; x<x1; x++)
+                zb[x] = ge.clear_depth;
+        }
+    }
+}
+
+
+void _geCopyImage(int psm, int width, int height,
+                  int srcw, const u8 *src, int destw, u8 *dest)
+{
+    int bpp = (psm == GU_PSM_8888 ? 4 : 2);
+    int j;
+
+    for (j=0; j<height; j++)
+        memcpy(dest + j*destw*bpp, src + j*srcw*bpp, width*bpp);
+}
+
+/* Execution */
+
+void _geInit()
+{
+    memset(&ge, 0, sizeof(GeState));
+
+    ge.fb_h = DEFAULT_FB_H;
+    ge.color = 0xFFFFFFFF;
+    ge.shade_model = GU_SMOOTH;
+    ge.alpha_func = GU_ALWAYS;
+    ge.alpha_mask = 0xFF;
+    ge.depth_func = GU_ALWAYS;
+    ge.blend_src = GU_SRC_ALPHA;
+    ge.blend_dst = GU_ONE_MINUS_SRC_ALPHA;
+    ge.tex_wrap_u = ge.tex_wrap_v = GU_REPEAT;
+    ge.tex_psm = GU_PSM_8888;
+
+    memset(&counters, 0, sizeof(GeCounters));
+    _geTexCacheFlush();
+}
+
+
+void _geGetCounters(GeCounters *out)
+{
+    *out = counters;
+}
+
+
+void _geExecute(const GuRecCommand *cmd)
+{
+    const int *a = cmd->args;
+
+    switch (cmd->op)
+    {
+        case GUREC_DRAW_BUFFER:
+            ge.draw_rel = (void*)cmd->ptr[0];
+            ge.draw_fbw = a[1];
+            break;
+
+        case GUREC_DEPTH_BUFFER:
+            ge.depth_rel = (void*)cmd->ptr[0];
+            ge.depth_fbw = a[0];
+            break;
+
+        case GUREC_OFFSET:
+            ge.off_x = a[0];
+            ge.off_y = a[1];
+            break;
+
+        case GUREC_VIEWPORT: // Bottom right corner of the drawing area.
+            ge.fb_w = a[0] + a[2] / 2 - ge.off_x;
+            ge.fb_h = a[1] + a[3] / 2 - ge.off_y;
+            break;
+
+        case GUREC_SCISSOR:
+            ge.sc_x0 = a[0];
+            ge.sc_y0 = a[1];
+            ge.sc_x1 = a[2];
+            ge.sc_y1 = a[3];
+            break;
+
+        case GUREC_ENABLE:
+            ge.states |= (1 << a[0]);
+            break;
+
+        case GUREC_DISABLE:
+            ge.states &= ~(1 << a[0]);
+            break;
+
+        case GUREC_DEPTH_FUNC:
+            ge.depth_func = a[0];
+            break;
+
+        case GUREC_ALPHA_FUNC:
+            ge.alpha_func = a[0];
+            ge.alpha_ref = a[1];
+            ge.alpha_mask = a[2];
+            break;
+
+        case GUREC_BLEND_FUNC:
+            ge.blend_op = a[0];
+            ge.blend_src = a[1];
+            ge.blend_dst = a[2];
+            ge.blend_srcfix = a[3];
+            ge.blend_dstfix = a[4];
+            break;
+
+        case GUREC_SHADE_MODEL:
+            ge.shade_model = a[0];
+            break;
+
+        case GUREC_COLOR:
+            ge.color = a[0];
+            break;
+
+        case GUREC_CLEAR_COLOR:
+            ge.clear_color = a[0];
+            break;
+
+        case GUREC_CLEAR_DEPTH:
+            ge.clear_depth = a[0];
+            break;
+
+        case GUREC_CLEAR:
+            _geClear(a[0]);
+            break;
+
+        case GUREC_TEX_FUNC:
+            ge.tfx = a[0];
+            ge.tcc = a[1];
+            break;
+
+        case GUREC_TEX_FILTER:
+            ge.tex_min = a[0];
+            ge.tex_mag = a[1];
+            break;
+
+        case GUREC_TEX_WRAP:
+            ge.tex_wrap_u = a[0];
+            ge.tex_wrap_v = a[1];
+            break;
+
+        case GUREC_TEX_MODE:
+            ge.tex_psm = a[0];
+            ge.tex_swizzle = a[3];
+            break;
+
+        case GUREC_TEX_IMAGE:
+            if (a[0] != 0) // Only the first level is sampled.
+                break;
+            ge.tex_w = a[1];
+            ge.tex_h = a[2];
+            ge.tex_tbw = a[3];
+            ge.tex_data = (const u8*)cmd->ptr[0];
+            break;
+
+        case GUREC_TEX_FLUSH:
+            _geTexCacheFlush();
+            break;
+
+        case GUREC_CLUT_MODE:
+            ge.clut_psm = a[0];
+            ge.clut_shift = a[1];
+            ge.clut_mask = a[2];
+            ge.clut_start = a[3];
+            break;
+
+        case GUREC_CLUT_LOAD: // Blocks of 8 entries, 32-bit only.
+            memcpy(ge.clut, cmd->ptr[0], a[0] * 8 * sizeof(u32));
+            break;
+
+        case GUREC_COPY_IMAGE:
+            _geCopyImage(a[0], a[1], a[2], a[3], cmd->ptr[0], a[4],
+                         (void*)cmd->ptr[1]);
+            break;
+
+        case GUREC_DRAW_ARRAY:
+            _geDrawArray(a[0], a[1], a[2], cmd->ptr[0], cmd->ptr[1]);
+            break;
+
+        default: // No effect on 2D transformed rendering.
+            break;
+    }
+}
+
+// EOF
@@ -0,0 +1,26 @@
+/*
+ * gLib2D - A simple, fast, light-weight 2D graphics library.
+ *
+ * Host backend: internal interface of the CPU rasterizer.
+ */
+
+#ifndef G2D_HOST_GE_H
+#define G2D_HOST_GE_H
+
+#include "gurec.h"
+
+/**
+ * Rasterizer counters, since sceGuInit().
+ */
+typedef struct
+{
+    unsigned long pixels;       // Fragments generated.
+    unsigned long tex_reads;    // Texel reads.
+    unsigned long tex_misses;   // Texture cache line fills.
+} GeCounters;
+
+void _geInit(void);
+void _geExecute(const GuRecCommand *cmd);
+void _geGetCounters(GeCounters *out);
+
+#endif
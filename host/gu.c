@@ -0,0 +1,717 @@
+/*
+ * gLib2D - A simple, fast, light-weight 2D graphics library.
+ *
+ * Copyright 2012 Clément Guérin <geecko.dev@free.fr>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Host backend: GU entry points.
+ * Calls are recorded into the current list (see gurec.h) and consume the
+ * same amount of list memory as the real GU. Direct lists are executed by
+ * the CPU rasterizer when they are finished, send lists when they are sent.
+ */
+
+#include "pspkernel.h"
+#include "pspdisplay.h"
+#include "pspgu.h"
+#include "vram.h"
+#include "gurec.h"
+#include "ge.h"
+
+#include <stdlib.h>
+
+/* Defines */
+
+#define CONTEXT_NBR             (3)
+#define RECORD_STEP             (256)
+
+/* Structures */
+
+typedef struct
+{
+    u8 *start;
+    u8 *current;
+    int parent;
+    GuRecCommand *cmds;
+    int n, size;
+} GuList;
+
+/* Local variables */
+
+static GuList lists[CONTEXT_NBR];
+static GuList *kept;        // Finished send & call lists.
+static int kept_nbr;
+static int curr_context;
+static int display = GU_FALSE;
+
+// Client side copy of the buffers, as VRAM relative pointers.
+static void *draw_rel, *disp_rel;
+static int draw_fbw;
+
+static GuRecList last;
+static GuRecCommand *last_cmds;
+static int last_size;
+static int list_count;
+static int sync_count;
+
+static const char *op_names[GUREC_OP_NBR] =
+{
+    "DrawBuffer", "DepthBuffer", "Offset", "Viewport", "Scissor",
+    "Enable", "Disable", "DepthRange", "DepthFunc", "AlphaFunc",
+    "BlendFunc", "ShadeModel", "Color", "ClearColor", "ClearDepth",
+    "Clear", "TexFunc", "TexFilter", "TexWrap", "TexMode", "TexImage",
+    "TexFlush", "TexSync", "ClutMode", "ClutLoad",
+    "CopyImage", "GetMemory", "DrawArray", "CallList", "Finish"
+};
+
+/* Kernel & display */
+
+void sceKernelDcacheWritebackRange(const void *p, unsigned int size)
+{
+    (void)p;
+    (void)size;
+}
+
+
+void sceKernelDcacheWritebackInvalidateRange(const void *p, unsigned int size)
+{
+    (void)p;
+    (void)size;
+}
+
+
+int sceDisplayWaitVblankStart()
+{
+    return 0;
+}
+
+/* Recording */
+
+GuRecCommand* _guRecord(GuRecOp op, int words)
+{
+    GuList *l = &lists[curr_context];
+    GuRecCommand *cmd;
+
+    // Every GE command is a 32-bit word. They are not encoded, but the list
+    // memory is consumed as on the real hardware.
+    if (l->current != NULL)
+        l->current += words * 4;
+
+    if (l->n == l->size)
+    {
+        l->size += RECORD_STEP;
+        l->cmds = realloc(l->cmds, l->size * sizeof(GuRecCommand));
+    }
+
+    cmd = &l->cmds[l->n++];
+    memset(cmd, 0, sizeof(GuRecCommand));
+    cmd->op = op;
+    cmd->words = words;
+
+    return cmd;
+}
+
+
+void _guRecord2(GuRecOp op, int words, int a0, int a1)
+{
+    GuRecCommand *cmd = _guRecord(op, words);
+
+    cmd->args[0] = a0;
+    cmd->args[1] = a1;
+}
+
+
+void _guSummarize(GuList *l, GuRecList *out)
+{
+    int i;
+
+    memset(out, 0, sizeof(GuRecList));
+    out->commands = l->cmds;
+    out->command_count = l->n;
+    out->list_bytes = l->current - l->start;
+
+    for (i=0; i<l->n; i++)
+    {
+        const GuRecCommand *cmd = &l->cmds[i];
+
+        out->op_count[cmd->op]++;
+
+        if (cmd->op == GUREC_DRAW_ARRAY)
+        {
+            out->draw_calls++;
+            out->vertices += cmd->args[2];
+        }
+        else if (cmd->op == GUREC_GET_MEMORY)
+        {
+            out->memory_bytes += cmd->words * 4;
+        }
+    }
+}
+
+
+const GuRecList* guRecLastList()
+{
+    return &last;
+}
+
+
+int guRecListCount()
+{
+    return list_count;
+}
+
+
+int guRecSyncCount()
+{
+    return sync_count;
+}
+
+
+const char* guRecOpName(GuRecOp op)
+{
+    if (op < 0 || op >= GUREC_OP_NBR)
+        return "?";
+
+    return op_names[op];
+}
+
+/* List management */
+
+void sceGuInit()
+{
+    int i;
+
+    for (i=0; i<CONTEXT_NBR; i++)
+    {
+        lists[i].start = lists[i].current = NULL;
+        lists[i].n = 0;
+    }
+
+    curr_context = GU_DIRECT;
+    display = GU_FALSE;
+    list_count = 0;
+    sync_count = 0;
+    memset(&last, 0, sizeof(GuRecList));
+
+    _geInit();
+}
+
+
+void sceGuTerm()
+{
+    int i;
+
+    for (i=0; i<CONTEXT_NBR; i++)
+    {
+        free(lists[i].cmds);
+        memset(&lists[i], 0, sizeof(GuList));
+    }
+
+    for (i=0; i<kept_nbr; i++)
+        free(kept[i].cmds);
+
+    free(kept);
+    kept = NULL;
+    kept_nbr = 0;
+
+    free(last_cmds);
+    last_cmds = NULL;
+    last_size = 0;
+    memset(&last, 0, sizeof(GuRecList));
+}
+
+
+void sceGuStart(int cid, void *list)
+{
+    GuList *l = &lists[cid];
+
+    l->start = (u8*)list;
+    l->current = (u8*)list;
+    l->parent = curr_context;
+    l->n = 0;
+    curr_context = cid;
+
+    // The draw buffer is sent again at the beginning of each direct list.
+    if (cid == GU_DIRECT && draw_fbw != 0)
+    {
+        GuRecCommand *cmd = _guRecord(GUREC_DRAW_BUFFER, 2);
+
+        cmd->args[0] = GU_PSM_8888;
+        cmd->args[1] = draw_fbw;
+        cmd->ptr[0] = draw_rel;
+    }
+}
+
+
+GuList* _guFindKept(const void *start)
+{
+    int i;
+
+    for (i=0; i<kept_nbr; i++)
+    {
+        if (kept[i].start == start)
+            return &kept[i];
+    }
+
+    return NULL;
+}
+
+
+void _guKeep(GuList *l)
+{
+    GuList *k = _guFindKept(l->start);
+
+    if (k == NULL)
+        k = _guFindKept(NULL);
+
+    if (k == NULL)
+    {
+        kept = realloc(kept, (kept_nbr+1) * sizeof(GuList));
+        k = &kept[kept_nbr++];
+        memset(k, 0, sizeof(GuList));
+    }
+
+    if (k->size < l->n)
+    {
+        k->size = l->size;
+        k->cmds = realloc(k->cmds, k->size * sizeof(GuRecCommand));
+    }
+    memcpy(k->cmds, l->cmds, l->n * sizeof(GuRecCommand));
+
+    k->start = l->start;
+    k->current = l->current;
+    k->n = l->n;
+}
+
+
+void _guRun(const GuList *l)
+{
+    const GuList *call;
+    int i;
+
+    for (i=0; i<l->n; i++)
+    {
+        const GuRecCommand *cmd = &l->cmds[i];
+
+        if (cmd->op != GUREC_CALL_LIST)
+        {
+            _geExecute(cmd);
+            continue;
+        }
+
+        // Only lists finished in the call context can be called.
+        call = _guFindKept(cmd->ptr[0]);
+        if (call != NULL && call != l)
+            _guRun(call);
+    }
+}
+
+
+void _guExecute(GuList *l)
+{
+    GeCounters before, after;
+
+    _geGetCounters(&before);
+    _guRun(l);
+    _geGetCounters(&after);
+
+    // Keep the capture, the list buffer can be reused right away.
+    if (last_size < l->n)
+    {
+        last_size = l->size;
+        last_cmds = realloc(last_cmds, last_size * sizeof(GuRecCommand));
+    }
+    memcpy(last_cmds, l->cmds, l->n * sizeof(GuRecCommand));
+
+    _guSummarize(l, &last);
+    last.commands = last_cmds;
+    last.pixels = after.pixels - before.pixels;
+    last.tex_reads = after.tex_reads - before.tex_reads;
+    last.tex_misses = after.tex_misses - before.tex_misses;
+    list_count++;
+}
+
+
+int sceGuFinish()
+{
+    GuList *l = &lists[curr_context];
+    int size;
+
+    _guRecord(GUREC_FINISH, curr_context == GU_CALL ? 1 : 2);
+    size = l->current - l->start;
+
+    if (curr_context == GU_DIRECT)
+        _guExecute(l);
+    else
+        _guKeep(l);
+
+    curr_context = l->parent;
+
+    return size;
+}
+
+
+int sceGuSendList(int mode, const void *list, PspGeContext *context)
+{
+    GuList *l = _guFindKept(list);
+
+    // Lists are executed in the order they are sent.
+    (void)mode;
+    (void)context;
+
+    if (list == NULL || l == NULL)
+        return -1;
+
+    _guExecute(l);
+    l->start = NULL;
+
+    return 0;
+}
+
+
+int sceGuSync(int mode, int what)
+{
+    // Lists are executed as soon as they are finished or sent, syncs are
+    // only counted.
+    (void)mode;
+    (void)what;
+
+    sync_count++;
+
+    return 0;
+}
+
+
+int sceGuCheckList()
+{
+    GuList *l = &lists[curr_context];
+
+    return l->current - l->start;
+}
+
+
+int sceGuDisplay(int state)
+{
+    int old = display;
+
+    display = state;
+
+    return old;
+}
+
+
+void* sceGuSwapBuffers()
+{
+    void *tmp = disp_rel;
+
+    disp_rel = draw_rel;
+    draw_rel = tmp;
+
+    return draw_rel;
+}
+
+
+void* sceGuGetMemory(int size)
+{
+    GuList *l = &lists[curr_context];
+    GuRecCommand *cmd;
+    u8 *p;
+
+    // The real GU jumps over the allocated block (two words).
+    size = (size + 3) & ~3;
+    cmd = _guRecord(GUREC_GET_MEMORY, 2 + size / 4);
+    cmd->args[0] = size;
+
+    p = l->current - size;
+    cmd->ptr[0] = p;
+
+    return p;
+}
+
+void sceGuCallList(const void *list)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_CALL_LIST, 2);
+
+    cmd->ptr[0] = list;
+}
+
+/* Buffers */
+
+void sceGuDrawBufferList(int psm, void *fbp, int fbw)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_DRAW_BUFFER, 2);
+
+    // Only sent to the list, the client side buffers are left untouched.
+    cmd->args[0] = psm;
+    cmd->args[1] = fbw;
+    cmd->ptr[0] = fbp;
+}
+
+
+void sceGuDrawBuffer(int psm, void *fbp, int fbw)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_DRAW_BUFFER, 3);
+
+    cmd->args[0] = psm; // Only GU_PSM_8888 render targets are supported.
+    cmd->args[1] = fbw;
+    cmd->ptr[0] = fbp;
+
+    draw_rel = fbp;
+    draw_fbw = fbw;
+}
+
+
+void sceGuDispBuffer(int width, int height, void *dispbp, int dispbw)
+{
+    (void)width;
+    (void)height;
+    (void)dispbw;
+
+    disp_rel = dispbp;
+}
+
+
+void sceGuDepthBuffer(void *zbp, int zbw)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_DEPTH_BUFFER, 2);
+
+    cmd->args[0] = zbw;
+    cmd->ptr[0] = zbp;
+}
+
+
+void sceGuOffset(unsigned int x, unsigned int y)
+{
+    _guRecord2(GUREC_OFFSET, 2, x, y);
+}
+
+
+void sceGuViewport(int cx, int cy, int width, int height)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_VIEWPORT, 4);
+
+    cmd->args[0] = cx;
+    cmd->args[1] = cy;
+    cmd->args[2] = width;
+    cmd->args[3] = height;
+}
+
+
+void sceGuScissor(int x, int y, int w, int h)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_SCISSOR, 2);
+
+    cmd->args[0] = x;
+    cmd->args[1] = y;
+    cmd->args[2] = w;
+    cmd->args[3] = h;
+}
+
+/* States */
+
+void sceGuEnable(int state)
+{
+    _guRecord2(GUREC_ENABLE, 1, state, 0);
+}
+
+
+void sceGuDisable(int state)
+{
+    _guRecord2(GUREC_DISABLE, 1, state, 0);
+}
+
+
+void sceGuDepthRange(int near, int far)
+{
+    _guRecord2(GUREC_DEPTH_RANGE, 4, near, far);
+}
+
+
+void sceGuDepthFunc(int function)
+{
+    _guRecord2(GUREC_DEPTH_FUNC, 1, function, 0);
+}
+
+
+void sceGuAlphaFunc(int func, int value, int mask)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_ALPHA_FUNC, 1);
+
+    cmd->args[0] = func;
+    cmd->args[1] = value;
+    cmd->args[2] = mask;
+}
+
+
+void sceGuBlendFunc(int op, int src, int dest,
+                    unsigned int srcfix, unsigned int destfix)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_BLEND_FUNC, 3);
+
+    cmd->args[0] = op;
+    cmd->args[1] = src;
+    cmd->args[2] = dest;
+    cmd->args[3] = srcfix;
+    cmd->args[4] = destfix;
+}
+
+
+void sceGuShadeModel(int mode)
+{
+    _guRecord2(GUREC_SHADE_MODEL, 1, mode, 0);
+}
+
+
+void sceGuColor(unsigned int color)
+{
+    // sceGuMaterial() on ambient, diffuse & specular, plus ambient alpha.
+    _guRecord2(GUREC_COLOR, 4, color, 0);
+}
+
+/* Clear */
+
+void sceGuClearColor(unsigned int color)
+{
+    // Stored in the context, sent with the next sceGuClear().
+    _guRecord2(GUREC_CLEAR_COLOR, 0, color, 0);
+}
+
+
+void sceGuClearDepth(unsigned int depth)
+{
+    _guRecord2(GUREC_CLEAR_DEPTH, 0, depth, 0);
+}
+
+
+void sceGuClear(int flags)
+{
+    // Clear strips are allocated from the list: (fbw/64) sprites of 2 vertices.
+    sceGuGetMemory((draw_fbw / 64) * 2 * 12);
+    _guRecord2(GUREC_CLEAR, 5, flags, 0);
+}
+
+/* Textures */
+
+void sceGuTexFunc(int tfx, int tcc)
+{
+    _guRecord2(GUREC_TEX_FUNC, 1, tfx, tcc);
+}
+
+
+void sceGuTexFilter(int min, int mag)
+{
+    _guRecord2(GUREC_TEX_FILTER, 1, min, mag);
+}
+
+
+void sceGuTexWrap(int u, int v)
+{
+    _guRecord2(GUREC_TEX_WRAP, 1, u, v);
+}
+
+
+void sceGuTexFlush()
+{
+    _guRecord(GUREC_TEX_FLUSH, 1);
+}
+
+
+void sceGuTexSync()
+{
+    _guRecord(GUREC_TEX_SYNC, 1);
+}
+
+
+void sceGuClutMode(unsigned int cpsm, unsigned int shift, unsigned int mask,
+                   unsigned int a3)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_CLUT_MODE, 1);
+
+    cmd->args[0] = cpsm;
+    cmd->args[1] = shift;
+    cmd->args[2] = mask;
+    cmd->args[3] = a3;
+}
+
+
+void sceGuClutLoad(int num_blocks, const void *cbp)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_CLUT_LOAD, 3);
+
+    cmd->args[0] = num_blocks;
+    cmd->ptr[0] = cbp;
+}
+
+
+void sceGuTexMode(int tpsm, int maxmips, int a2, int swizzle)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_TEX_MODE, 2);
+
+    cmd->args[0] = tpsm;
+    cmd->args[1] = maxmips;
+    cmd->args[2] = a2;
+    cmd->args[3] = swizzle;
+
+    sceGuTexFlush();
+}
+
+
+void sceGuTexImage(int mipmap, int width, int height, int tbw,
+                   const void *tbp)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_TEX_IMAGE, 3);
+
+    cmd->args[0] = mipmap;
+    cmd->args[1] = width;
+    cmd->args[2] = height;
+    cmd->args[3] = tbw;
+    cmd->ptr[0] = tbp;
+
+    sceGuTexFlush();
+}
+
+/* Transfers */
+
+void sceGuCopyImage(int psm, int sx, int sy, int width, int height, int srcw,
+                    void *src, int dx, int dy, int destw, void *dest)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_COPY_IMAGE, 8);
+    int bpp = (psm == GU_PSM_8888 ? 4 : 2);
+
+    cmd->args[0] = psm;
+    cmd->args[1] = width;
+    cmd->args[2] = height;
+    cmd->args[3] = srcw;
+    cmd->args[4] = destw;
+    cmd->ptr[0] = (u8*)src + (sy*srcw + sx) * bpp;
+    cmd->ptr[1] = (u8*)dest + (dy*destw + dx) * bpp;
+}
+
+/* Drawing */
+
+void sceGuDrawArray(int prim, int vtype, int count,
+                    const void *indices, const void *vertices)
+{
+    GuRecCommand *cmd = _guRecord(GUREC_DRAW_ARRAY, indices != NULL ? 5 : 4);
+
+    cmd->args[0] = prim;
+    cmd->args[1] = vtype;
+    cmd->args[2] = count;
+    cmd->ptr[0] = indices;
+    cmd->ptr[1] = vertices;
+}
+
+// EOF
@@ -0,0 +1,113 @@
+/*
+ * gLib2D - A simple, fast, light-weight 2D graphics library.
+ *
+ * Host backend: display list recording.
+ * Every sceGu* call made between sceGuStart() and sceGuFinish() is captured
+ * as a GuRecCommand, then replayed by the CPU rasterizer when a direct list
+ * is finished, or a send list is sent. Call lists are replayed where they
+ * are called. The capture of the last executed list (one per frame with
+ * gLib2D) can be queried to assert on draw calls and list usage.
+ */
+
+#ifndef G2D_HOST_GUREC_H
+#define G2D_HOST_GUREC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Recorded entry points.
+ */
+typedef enum
+{
+    GUREC_DRAW_BUFFER,
+    GUREC_DEPTH_BUFFER,
+    GUREC_OFFSET,
+    GUREC_VIEWPORT,
+    GUREC_SCISSOR,
+    GUREC_ENABLE,
+    GUREC_DISABLE,
+    GUREC_DEPTH_RANGE,
+    GUREC_DEPTH_FUNC,
+    GUREC_ALPHA_FUNC,
+    GUREC_BLEND_FUNC,
+    GUREC_SHADE_MODEL,
+    GUREC_COLOR,
+    GUREC_CLEAR_COLOR,
+    GUREC_CLEAR_DEPTH,
+    GUREC_CLEAR,
+    GUREC_TEX_FUNC,
+    GUREC_TEX_FILTER,
+    GUREC_TEX_WRAP,
+    GUREC_TEX_MODE,
+    GUREC_TEX_IMAGE,
+    GUREC_TEX_FLUSH,
+    GUREC_TEX_SYNC,
+    GUREC_CLUT_MODE,
+    GUREC_CLUT_LOAD,
+    GUREC_COPY_IMAGE,
+    GUREC_GET_MEMORY,
+    GUREC_DRAW_ARRAY,
+    GUREC_CALL_LIST,
+    GUREC_FINISH,
+    GUREC_OP_NBR
+} GuRecOp;
+
+/**
+ * One recorded call. args[] holds the integer arguments in call order,
+ * ptr[] the pointer ones (sceGuDrawArray: indices then vertices).
+ */
+typedef struct
+{
+    GuRecOp op;
+    int args[5];
+    const void *ptr[2];
+    int words;          // Display list words emitted by the real GU.
+} GuRecCommand;
+
+/**
+ * A finished list.
+ */
+typedef struct
+{
+    const GuRecCommand *commands;
+    int command_count;
+    int op_count[GUREC_OP_NBR];
+    int draw_calls;     // sceGuDrawArray calls.
+    int vertices;       // Vertices (or indices) passed to sceGuDrawArray.
+    int memory_bytes;   // Taken by sceGuGetMemory, jump words included.
+    int list_bytes;     // Total list size, as returned by sceGuFinish().
+    // Filled by the CPU rasterizer when the list is replayed. Texture cache
+    // model: 8 KiB, 2 ways, 64-byte lines, flushed by sceGuTexFlush().
+    unsigned long pixels;       // Fragments generated.
+    unsigned long tex_reads;    // Texel reads, 4 per fragment when filtered.
+    unsigned long tex_misses;   // Texture cache line fills.
+} GuRecList;
+
+/**
+ * Returns the capture of the last executed list (finished direct list or
+ * sent list). Valid until the next list is executed.
+ */
+const GuRecList* guRecLastList(void);
+
+/**
+ * Returns how many lists have been executed since sceGuInit().
+ */
+int guRecListCount(void);
+
+/**
+ * Returns how many times sceGuSync() has been called since sceGuInit().
+ */
+int guRecSyncCount(void);
+
+/**
+ * Returns the name of a GuRecOp, for dumps.
+ */
+const char* guRecOpName(GuRecOp op);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * gLib2D - A simple, fast, light-weight 2D graphics library.
+ *
+ * Host stand-in for the PSPSDK display header.
+ */
+
+#ifndef G2D_HOST_PSPDISPLAY_H
+#define G2D_HOST_PSPDISPLAY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Returns immediately, there is no screen to wait for on the host.
+ */
+int sceDisplayWaitVblankStart(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
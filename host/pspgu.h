@@ -0,0 +1,236 @@
+/*
+ * gLib2D - A simple, fast, light-weight 2D graphics library.
+ *
+ * Host stand-in for the PSPSDK GU header.
+ * Constants have the same values as the real ones, only the subset of the
+ * API used by glib2d.c is provided. Everything is rendered by a CPU
+ * rasterizer into a simulated VRAM (see vram.h).
+ */
+
+#ifndef G2D_HOST_PSPGU_H
+#define G2D_HOST_PSPGU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GU_FALSE                (0)
+#define GU_TRUE                 (1)
+
+/* Primitive types */
+#define GU_POINTS               (0)
+#define GU_LINES                (1)
+#define GU_LINE_STRIP           (2)
+#define GU_TRIANGLES            (3)
+#define GU_TRIANGLE_STRIP       (4)
+#define GU_TRIANGLE_FAN         (5)
+#define GU_SPRITES              (6)
+
+/* States */
+#define GU_ALPHA_TEST           (0)
+#define GU_DEPTH_TEST           (1)
+#define GU_SCISSOR_TEST         (2)
+#define GU_STENCIL_TEST         (3)
+#define GU_BLEND                (4)
+#define GU_CULL_FACE            (5)
+#define GU_DITHER               (6)
+#define GU_FOG                  (7)
+#define GU_CLIP_PLANES          (8)
+#define GU_TEXTURE_2D           (9)
+#define GU_LIGHTING             (10)
+
+/* Vertex declarations */
+#define GU_TEXTURE_SHIFT(n)     ((n)<<0)
+#define GU_TEXTURE_8BIT         GU_TEXTURE_SHIFT(1)
+#define GU_TEXTURE_16BIT        GU_TEXTURE_SHIFT(2)
+#define GU_TEXTURE_32BITF       GU_TEXTURE_SHIFT(3)
+#define GU_TEXTURE_BITS         GU_TEXTURE_SHIFT(3)
+
+#define GU_COLOR_SHIFT(n)       ((n)<<2)
+#define GU_COLOR_5650           GU_COLOR_SHIFT(4)
+#define GU_COLOR_5551           GU_COLOR_SHIFT(5)
+#define GU_COLOR_4444           GU_COLOR_SHIFT(6)
+#define GU_COLOR_8888           GU_COLOR_SHIFT(7)
+#define GU_COLOR_BITS           GU_COLOR_SHIFT(7)
+
+#define GU_NORMAL_SHIFT(n)      ((n)<<5)
+#define GU_NORMAL_8BIT          GU_NORMAL_SHIFT(1)
+#define GU_NORMAL_16BIT         GU_NORMAL_SHIFT(2)
+#define GU_NORMAL_32BITF        GU_NORMAL_SHIFT(3)
+#define GU_NORMAL_BITS          GU_NORMAL_SHIFT(3)
+
+#define GU_VERTEX_SHIFT(n)      ((n)<<7)
+#define GU_VERTEX_8BIT          GU_VERTEX_SHIFT(1)
+#define GU_VERTEX_16BIT         GU_VERTEX_SHIFT(2)
+#define GU_VERTEX_32BITF        GU_VERTEX_SHIFT(3)
+#define GU_VERTEX_BITS          GU_VERTEX_SHIFT(3)
+
+#define GU_INDEX_SHIFT(n)       ((n)<<11)
+#define GU_INDEX_8BIT           GU_INDEX_SHIFT(1)
+#define GU_INDEX_16BIT          GU_INDEX_SHIFT(2)
+#define GU_INDEX_BITS           GU_INDEX_SHIFT(3)
+
+#define GU_TRANSFORM_SHIFT(n)   ((n)<<23)
+#define GU_TRANSFORM_3D         GU_TRANSFORM_SHIFT(0)
+#define GU_TRANSFORM_2D         GU_TRANSFORM_SHIFT(1)
+#define GU_TRANSFORM_BITS       GU_TRANSFORM_SHIFT(1)
+
+/* Pixel formats */
+#define GU_PSM_5650             (0)
+#define GU_PSM_5551             (1)
+#define GU_PSM_4444             (2)
+#define GU_PSM_8888             (3)
+#define GU_PSM_T4               (4)
+#define GU_PSM_T8               (5)
+#define GU_PSM_T16              (6)
+#define GU_PSM_T32              (7)
+#define GU_PSM_DXT1             (8)
+#define GU_PSM_DXT3             (9)
+#define GU_PSM_DXT5             (10)
+
+/* Shading model */
+#define GU_FLAT                 (0)
+#define GU_SMOOTH               (1)
+
+/* Texture filter */
+#define GU_NEAREST              (0)
+#define GU_LINEAR               (1)
+
+/* Texture wrap */
+#define GU_REPEAT               (0)
+#define GU_CLAMP                (1)
+
+/* Test functions */
+#define GU_NEVER                (0)
+#define GU_ALWAYS               (1)
+#define GU_EQUAL                (2)
+#define GU_NOTEQUAL             (3)
+#define GU_LESS                 (4)
+#define GU_LEQUAL               (5)
+#define GU_GREATER              (6)
+#define GU_GEQUAL               (7)
+
+/* Clear buffer mask */
+#define GU_COLOR_BUFFER_BIT     (1)
+#define GU_STENCIL_BUFFER_BIT   (2)
+#define GU_DEPTH_BUFFER_BIT     (4)
+#define GU_FAST_CLEAR_BIT       (16)
+
+/* Texture effect */
+#define GU_TFX_MODULATE         (0)
+#define GU_TFX_DECAL            (1)
+#define GU_TFX_BLEND            (2)
+#define GU_TFX_REPLACE          (3)
+#define GU_TFX_ADD              (4)
+
+/* Texture color component */
+#define GU_TCC_RGB              (0)
+#define GU_TCC_RGBA             (1)
+
+/* Blending op */
+#define GU_ADD                  (0)
+#define GU_SUBTRACT             (1)
+#define GU_REVERSE_SUBTRACT     (2)
+#define GU_MIN                  (3)
+#define GU_MAX                  (4)
+#define GU_ABS                  (5)
+
+/* Blending factor */
+#define GU_SRC_COLOR            (0)
+#define GU_ONE_MINUS_SRC_COLOR  (1)
+#define GU_SRC_ALPHA            (2)
+#define GU_ONE_MINUS_SRC_ALPHA  (3)
+#define GU_DST_COLOR            (0)
+#define GU_ONE_MINUS_DST_COLOR  (1)
+#define GU_DST_ALPHA            (4)
+#define GU_ONE_MINUS_DST_ALPHA  (5)
+#define GU_FIX                  (10)
+
+/* List contexts */
+#define GU_DIRECT               (0)
+#define GU_CALL                 (1)
+#define GU_SEND                 (2)
+
+/* List queue */
+#define GU_TAIL                 (0)
+#define GU_HEAD                 (1)
+
+/* Sync */
+#define GU_SYNC_FINISH          (0)
+#define GU_SYNC_SIGNAL          (1)
+#define GU_SYNC_DONE            (2)
+#define GU_SYNC_LIST            (3)
+#define GU_SYNC_SEND            (4)
+
+#define GU_SYNC_WAIT            (0)
+#define GU_SYNC_NOWAIT          (1)
+
+typedef struct
+{
+    unsigned int context[512];
+} PspGeContext;
+
+/* Setup */
+void sceGuInit(void);
+void sceGuTerm(void);
+void sceGuStart(int cid, void *list);
+int sceGuFinish(void);
+int sceGuSync(int mode, int what);
+int sceGuCheckList(void);
+int sceGuDisplay(int state);
+void* sceGuSwapBuffers(void);
+void* sceGuGetMemory(int size);
+int sceGuSendList(int mode, const void *list, PspGeContext *context);
+void sceGuCallList(const void *list);
+
+/* Buffers */
+void sceGuDrawBuffer(int psm, void *fbp, int fbw);
+void sceGuDrawBufferList(int psm, void *fbp, int fbw);
+void sceGuDispBuffer(int width, int height, void *dispbp, int dispbw);
+void sceGuDepthBuffer(void *zbp, int zbw);
+void sceGuOffset(unsigned int x, unsigned int y);
+void sceGuViewport(int cx, int cy, int width, int height);
+void sceGuScissor(int x, int y, int w, int h);
+
+/* States */
+void sceGuEnable(int state);
+void sceGuDisable(int state);
+void sceGuDepthRange(int near, int far);
+void sceGuDepthFunc(int function);
+void sceGuAlphaFunc(int func, int value, int mask);
+void sceGuBlendFunc(int op, int src, int dest,
+                    unsigned int srcfix, unsigned int destfix);
+void sceGuShadeModel(int mode);
+void sceGuColor(unsigned int color);
+
+/* Clear */
+void sceGuClearColor(unsigned int color);
+void sceGuClearDepth(unsigned int depth);
+void sceGuClear(int flags);
+
+/* Textures */
+void sceGuTexFunc(int tfx, int tcc);
+void sceGuTexFilter(int min, int mag);
+void sceGuTexWrap(int u, int v);
+void sceGuTexMode(int tpsm, int maxmips, int a2, int swizzle);
+void sceGuTexImage(int mipmap, int width, int height, int tbw,
+                   const void *tbp);
+void sceGuTexFlush(void);
+void sceGuTexSync(void);
+void sceGuClutMode(unsigned int cpsm, unsigned int shift, unsigned int mask,
+                   unsigned int a3);
+void sceGuClutLoad(int num_blocks, const void *cbp);
+
+/* Transfers */
+void sceGuCopyImage(int psm, int sx, int sy, int width, int height, int srcw,
+                    void *src, int dx, int dy, int destw, void *dest);
+
+/* Drawing */
+void sceGuDrawArray(int prim, int vtype, int count,
+                    const void *indices, const void *vertices);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
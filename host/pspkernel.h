@@ -0,0 +1,36 @@
+/*
+ * gLib2D - A simple, fast, light-weight 2D graphics library.
+ *
+ * Host stand-in for the PSPSDK kernel header.
+ * Only what glib2d.c needs is declared here.
+ */
+
+#ifndef G2D_HOST_PSPKERNEL_H
+#define G2D_HOST_PSPKERNEL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+
+/**
+ * Nothing to write back on the host, the "GE" reads main memory directly.
+ */
+void sceKernelDcacheWritebackRange(const void *p, unsigned int size);
+void sceKernelDcacheWritebackInvalidateRange(const void *p, unsigned int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
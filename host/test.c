@@ -0,0 +1,1127 @@
+/*
+ * gLib2D - A simple, fast, light-weight 2D graphics library.
+ *
+ * Host tests.
+ * Each check prints its result, the exit status is the number of failed
+ * checks, so that "make -C host test" fails with them.
+ */
+
+#include "../glib2d.h"
+#include "gurec.h"
+#include "pspgu.h"
+
+#include <math.h>
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SINCOS_NBR              (1000000)
+#define SINCOS_ERROR            (1e-7)
+#define ROTATION_NBR            (10000)
+#define ROTATION_ERROR          (1e-5)
+#define POOL_TEX_NBR            (4)     // 1 MiB, the pool is 688 KiB.
+#define POOL_TEX_SIZE           (256)
+#define POOL_FRAME_NBR          (9)
+#define FRAME_SIZE              (512*G2D_SCR_H)
+#define PALETTE_PATH            "tests_palette.png"
+#define PALETTE_TEX_SIZE        (32)
+#define DDS_PATH                "tests_texture.dds"
+#define DXT_W                   (8)     // 2 blocks of 4*4 texels.
+#define DXT_H                   (4)
+#define DXT_SCALE               (8)
+#define SCENE_BATCH_NBR         (60)    // 3 times the initial store size.
+#define SCENE_OBJ_NBR           (50)
+#define BULK_NBR                (200)
+#define MESH_COLS               (8)
+#define MESH_ROWS               (4)
+#define MESH_CELL               (16)    // Texels, the texture is 128x64.
+#define CULL_OBJ_NBR            (200)
+#define CULL_MARGIN             (150)   // Objects are placed this far out.
+
+// Internal kernels, see glib2d.c.
+void _g2dFastSinCos(float x, float *s, float *c);
+void _g2dSetClipping(bool use);
+void _g2dSetCulling(bool use);
+void _g2dSetSliceWidth(int w);
+
+static int failures = 0;
+static unsigned int seed;
+static g2dColor ref_frame[FRAME_SIZE];
+
+
+void check(const char *name, int ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+
+    if (!ok)
+        failures++;
+}
+
+
+// Repeatable random numbers, the same for both paths of a comparison.
+int rnd(int n)
+{
+    seed = seed * 1103515245 + 12345;
+
+    return (seed >> 16) % n;
+}
+
+
+g2dTexture* random_tex(int w, int h)
+{
+    g2dTexture *tex = g2dTexCreate(w, h, G2D_VOID);
+    int i;
+
+    for (i=0; i<tex->tw*tex->th; i++)
+        tex->data[i] = rand() | 0xFF000000;
+
+    return tex;
+}
+
+
+// The displayed frame is kept, to compare the next ones with it.
+void frame_ref()
+{
+    memcpy(ref_frame, g2d_disp_buffer.data, sizeof(ref_frame));
+}
+
+
+bool frame_same()
+{
+    return memcmp(ref_frame, g2d_disp_buffer.data, sizeof(ref_frame)) == 0;
+}
+
+
+// Channels may differ by 1, e.g. for filtered texels at a float rounding
+// away.
+bool frame_close()
+{
+    const unsigned char *a = (const unsigned char*)ref_frame;
+    const unsigned char *b = (const unsigned char*)g2d_disp_buffer.data;
+    unsigned int i;
+
+    for (i=0; i<sizeof(ref_frame); i++)
+    {
+        if (a[i] - b[i] > 1 || b[i] - a[i] > 1)
+            return false;
+    }
+
+    return true;
+}
+
+
+double sincos_error(float range)
+{
+    double e, max = 0.;
+    float x, s, c;
+    int i;
+
+    for (i=0; i<=SINCOS_NBR; i++)
+    {
+        x = range * (2.f * i / SINCOS_NBR - 1.f);
+        _g2dFastSinCos(x, &s, &c);
+
+        e = fabs(s - sin(x));
+        if (e > max)
+            max = e;
+
+        e = fabs(c - cos(x));
+        if (e > max)
+            max = e;
+    }
+
+    return max;
+}
+
+
+// Angle difference, modulo 2*pi.
+double angle_error(double a, double b)
+{
+    return fabs(remainder(a - b, 2. * M_PI));
+}
+
+
+void test_sincos()
+{
+    double e, max = 0.;
+    float a, r, d;
+    int i;
+
+    check("sincos, |x| <= 2*pi", sincos_error(2.f * M_PI) < SINCOS_ERROR);
+    check("sincos, |x| <= 8192", sincos_error(8192.f) < SINCOS_ERROR);
+
+    // The angle set by sine and cosine is derived back with atan2f().
+    g2dBeginRects(NULL);
+
+    for (i=0; i<ROTATION_NBR; i++)
+    {
+        a = (rand() / (float)RAND_MAX - 0.5f) * 4.f * M_PI;
+
+        g2dSetRotationSinCos(sinf(a), cosf(a));
+        g2dGetRotationRad(&r);
+        e = angle_error(r, a);
+        if (e > max)
+            max = e;
+
+        g2dSetRotationSinCos(sinf(a), cosf(a));
+        g2dGetRotation(&d);
+        e = angle_error(d * M_PI / 180., a);
+        if (e > max)
+            max = e;
+
+        g2dSetRotationSinCos(sinf(a), cosf(a));
+        g2dSetRotationRadRelative(0.5f);
+        g2dGetRotationRad(&r);
+        e = angle_error(r, a + 0.5f);
+        if (e > max)
+            max = e;
+    }
+
+    g2dEnd();
+
+    check("rotation, sine & cosine round trip", max < ROTATION_ERROR);
+}
+
+
+// Draws the textures of a mask, in order. Returns which ones were bound
+// from the VRAM pool, from the textures set by the last list.
+unsigned int pool_draw(g2dTexture *tex[], unsigned int mask)
+{
+    const GuRecList *l;
+    unsigned int vram = 0;
+    int i, k = 0;
+
+    g2dClear(BLACK);
+
+    for (i=0; i<POOL_TEX_NBR; i++)
+    {
+        if ((mask & (1 << i)) == 0)
+            continue;
+
+        g2dBeginRects(tex[i]);
+        g2dSetCoordXY(i * 120, 0);
+        g2dSetScaleWH(110, 110 + i * 40);
+        g2dAdd();
+        g2dEnd();
+    }
+
+    g2dFlip(G2D_VSYNC);
+
+    l = guRecLastList();
+
+    for (i=0; i<l->command_count; i++)
+    {
+        if (l->commands[i].op != GUREC_TEX_IMAGE)
+            continue;
+
+        while ((mask & (1 << k)) == 0)
+            k++;
+
+        if (l->commands[i].ptr[0] != tex[k]->data)
+            vram |= 1 << k;
+
+        k++;
+    }
+
+    return vram;
+}
+
+
+void test_vram_pool()
+{
+    // Textures A, B, C & D of 256 KiB, the pool holds 2 of them.
+    enum { A = 1, B = 2, C = 4, D = 8, K = 256*1024 };
+    static const struct
+    {
+        unsigned int mask, vram, hits, misses, bytes;
+    } frames[POOL_FRAME_NBR] =
+    {
+        {A|B,   0,   0, 2, 0},      // Candidates.
+        {A|B,   A|B, 0, 2, 2*K},    // Promoted in the 2nd frame.
+        {A|B,   A|B, 2, 0, 2*K},
+        {A|C,   A,   1, 1, 2*K},
+        {A|C,   A|C, 1, 1, 2*K},    // B is the least recently used.
+        {A|B|C, A|C, 2, 1, 2*K},    // B starts over from RAM.
+        {A|C|D, A|C, 2, 1, 2*K},
+        {A|C|D, A|C, 2, 1, 2*K},    // A & C are drawn, D stays in RAM.
+        {D,     D,   0, 1, 2*K}     // A or C is evicted.
+    };
+    static g2dColor ram[POOL_FRAME_NBR][FRAME_SIZE];
+    g2dTexture *tex[POOL_TEX_NBR];
+    g2dFrameStats stats;
+    unsigned int vram;
+    bool ok, same = true;
+    char name[64];
+    int f, i;
+
+    for (i=0; i<POOL_TEX_NBR; i++)
+    {
+        tex[i] = g2dTexCreate(POOL_TEX_SIZE, POOL_TEX_SIZE, G2D_VOID);
+
+        for (f=0; f<POOL_TEX_SIZE*POOL_TEX_SIZE; f++)
+            tex[i]->data[f] = rand() | 0xFF000000;
+    }
+
+    // Reference frames, from RAM.
+    for (f=0; f<POOL_FRAME_NBR; f++)
+    {
+        pool_draw(tex, frames[f].mask);
+        memcpy(ram[f], g2d_disp_buffer.data, sizeof(ram[f]));
+    }
+
+    g2dSetVramPool(true);
+
+    for (f=0; f<POOL_FRAME_NBR; f++)
+    {
+        vram = pool_draw(tex, frames[f].mask);
+        g2dGetFrameStats(&stats);
+
+        ok = (vram == frames[f].vram &&
+              stats.vram_hits == frames[f].hits &&
+              stats.vram_misses == frames[f].misses &&
+              stats.vram_bytes == frames[f].bytes);
+
+        if (memcmp(ram[f], g2d_disp_buffer.data, sizeof(ram[f])) != 0)
+            same = false;
+
+        sprintf(name, "vram pool, frame %d", f);
+        check(name, ok);
+    }
+
+    check("vram pool, pixels match the RAM path", same);
+
+    g2dSetVramPool(false);
+
+    for (i=0; i<POOL_TEX_NBR; i++)
+        g2dTexFree(&tex[i]);
+}
+
+
+// Writes a 4 colors paletted PNG, colors exact in all 16-bit formats.
+bool palette_write(const char *path)
+{
+    png_color palette[4] =
+        {{0x00, 0x00, 0x00}, {0xFF, 0x00, 0x00},
+         {0x00, 0xFF, 0x00}, {0xFF, 0xFF, 0xFF}};
+    png_byte row[PALETTE_TEX_SIZE];
+    png_structp png_ptr;
+    png_infop info_ptr;
+    FILE *fp;
+    int x, y;
+
+    if ((fp = fopen(path, "wb")) == NULL)
+        return false;
+
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info_ptr = png_create_info_struct(png_ptr);
+    png_init_io(png_ptr, fp);
+    png_set_IHDR(png_ptr, info_ptr, PALETTE_TEX_SIZE, PALETTE_TEX_SIZE, 8,
+                 PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_set_PLTE(png_ptr, info_ptr, palette, 4);
+    png_write_info(png_ptr, info_ptr);
+
+    for (y=0; y<PALETTE_TEX_SIZE; y++)
+    {
+        for (x=0; x<PALETTE_TEX_SIZE; x++)
+            row[x] = (x / 4 + y / 8) % 4;
+
+        png_write_row(png_ptr, row);
+    }
+
+    png_write_end(png_ptr, info_ptr);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    fclose(fp);
+
+    return true;
+}
+
+
+void palette_draw(g2dTexture *tex)
+{
+    g2dClear(BLACK);
+    g2dBeginRects(tex);
+    g2dSetTexLinear(false);
+    g2dSetScaleWH(4 * PALETTE_TEX_SIZE, 4 * PALETTE_TEX_SIZE);
+    g2dAdd();
+    g2dEnd();
+    g2dFlip(G2D_VSYNC);
+}
+
+
+void test_palette_png()
+{
+    static const struct
+    {
+        const char *name;
+        g2dTex_Mode mode;
+    } modes[] =
+    {
+        {"5650", G2D_5650}, {"5551", G2D_5551}, {"4444", G2D_4444},
+        {"5650, dithered", G2D_5650 | G2D_DITHER},
+        {"4444, diffused", G2D_4444 | G2D_DIFFUSE},
+        {"T8", G2D_T8}, {"T4", G2D_T4}
+    };
+    static g2dColor ref[FRAME_SIZE];
+    g2dTexture *tex;
+    char name[64];
+    unsigned int i;
+
+    if (!palette_write(PALETTE_PATH))
+    {
+        check("paletted png, written", false);
+        return;
+    }
+
+    tex = g2dTexLoad(PALETTE_PATH, G2D_VOID);
+    check("paletted png, 8888", tex != NULL);
+    if (tex == NULL)
+        return;
+
+    palette_draw(tex);
+    memcpy(ref, g2d_disp_buffer.data, sizeof(ref));
+    g2dTexFree(&tex);
+
+    // Converted from truecolor, or kept indexed.
+    for (i=0; i<sizeof(modes)/sizeof(modes[0]); i++)
+    {
+        sprintf(name, "paletted png, %s", modes[i].name);
+
+        if ((tex = g2dTexLoad(PALETTE_PATH, modes[i].mode)) == NULL)
+        {
+            check(name, false);
+            continue;
+        }
+
+        palette_draw(tex);
+        check(name, tex->psm != GU_PSM_8888 &&
+                    memcmp(ref, g2d_disp_buffer.data, sizeof(ref)) == 0);
+        g2dTexFree(&tex);
+    }
+
+    remove(PALETTE_PATH);
+}
+
+
+// A DDS header, then the blocks of the first mipmap level.
+bool dds_write(const char *path, const char *fourcc, unsigned int w,
+               unsigned int h, const void *blocks, size_t size)
+{
+    unsigned int header[32] = {0};
+    FILE *fp;
+    bool ok;
+
+    memcpy(&header[0], "DDS ", 4);
+    header[1] = 124;
+    header[2] = 0x1007;     // Caps, height, width & pixel format.
+    header[3] = h;
+    header[4] = w;
+    header[19] = 32;
+    header[20] = 0x4;       // FourCC.
+    memcpy(&header[21], fourcc, 4);
+
+    if ((fp = fopen(path, "wb")) == NULL)
+        return false;
+
+    ok = fwrite(header, sizeof(header), 1, fp) == 1 &&
+         (size == 0 || fwrite(blocks, size, 1, fp) == 1);
+    fclose(fp);
+
+    return ok;
+}
+
+
+bool dds_rejected(const char *fourcc, unsigned int w, unsigned int h,
+                  size_t size)
+{
+    static unsigned char blocks[512*512];
+    g2dTexture *tex;
+
+    if (!dds_write(DDS_PATH, fourcc, w, h, blocks, size))
+        return false;
+
+    if ((tex = g2dTexLoad(DDS_PATH, G2D_VOID)) == NULL)
+        return true;
+
+    g2dTexFree(&tex);
+
+    return false;
+}
+
+
+void test_dds_checks()
+{
+    // 8*4 texels are 2 DXT1 blocks of 8 bytes, or 2 DXT5 ones of 16.
+    check("dds, complete loaded", !dds_rejected("DXT1", 8, 4, 16));
+    check("dds, truncated rejected", dds_rejected("DXT1", 8, 4, 15) &&
+                                     dds_rejected("DXT5", 8, 4, 16));
+    check("dds, no blocks rejected", dds_rejected("DXT3", 8, 4, 0));
+    // 32768*32768 DXT5 texels overflow the texture size, a row of blocks
+    // would be written past the buffer.
+    check("dds, oversized rejected", dds_rejected("DXT1", 1024, 4, 1024) &&
+                                     dds_rejected("DXT5", 32768, 32768,
+                                                  32768 / 4 * 16) &&
+                                     dds_rejected("DXT5", 0x80000004, 4, 0));
+    check("dds, empty rejected", dds_rejected("DXT1", 0, 4, 16) &&
+                                 dds_rejected("DXT1", 4, 0, 16));
+
+    remove(DDS_PATH);
+}
+
+
+// Two blocks of standard RGB565 endpoints: red & blue, then green & white,
+// whose order makes DXT1 use 3 colors and a transparent one. Texel i of a
+// block uses the color code i % 4, the DXT3 alpha i, the DXT5 code i % 8.
+static const unsigned short dxt_ends[2][2] = {{0xF800, 0x001F},
+                                              {0x07E0, 0xFFFF}};
+static const unsigned char dxt5_alpha[2][2] = {{0xFF, 0x00}, {0x00, 0xFF}};
+
+// Decoded by hand, 4 then 3 colors (DXT1 only), and the DXT5 alphas.
+static const g2dColor dxt_colors[2][4] =
+{
+    {G2D_RGBA(255, 0, 0, 255), G2D_RGBA(0, 0, 255, 255),
+     G2D_RGBA(170, 0, 85, 255), G2D_RGBA(85, 0, 170, 255)},
+    {G2D_RGBA(0, 255, 0, 255), G2D_RGBA(255, 255, 255, 255),
+     G2D_RGBA(85, 255, 85, 255), G2D_RGBA(170, 255, 170, 255)}
+};
+static const g2dColor dxt1_colors[4] =
+    {G2D_RGBA(0, 255, 0, 255), G2D_RGBA(255, 255, 255, 255),
+     G2D_RGBA(127, 255, 127, 255), G2D_RGBA(0, 0, 0, 0)};
+static const int dxt5_alphas[2][8] =
+{
+    {255, 0, 218, 182, 145, 109, 72, 36},
+    {0, 255, 51, 102, 153, 204, 0, 255}
+};
+
+
+// The blocks of a DDS file, and the texels they hold.
+size_t dxt_blocks(int psm, unsigned char *blocks, g2dColor *texels)
+{
+    unsigned char *p = blocks;
+    unsigned long long alpha;
+    unsigned int indices = 0xE4E4E4E4, a;
+    g2dColor c;
+    int b, i, k;
+
+    for (b=0; b<2; b++)
+    {
+        if (psm == GU_PSM_DXT3)
+        {
+            alpha = 0xFEDCBA9876543210ULL;
+            memcpy(p, &alpha, 8);
+            p += 8;
+        }
+        else if (psm == GU_PSM_DXT5)
+        {
+            for (alpha=0, i=0; i<16; i++)
+                alpha |= (unsigned long long)(i % 8) << (3*i);
+
+            memcpy(p, dxt5_alpha[b], 2);
+            memcpy(p + 2, &alpha, 6);
+            p += 8;
+        }
+
+        memcpy(p, dxt_ends[b], 4);
+        memcpy(p + 4, &indices, 4);
+        p += 8;
+
+        for (i=0; i<16; i++)
+        {
+            k = i % 4;
+            c = (psm == GU_PSM_DXT1 && b == 1 ? dxt1_colors[k] :
+                                                dxt_colors[b][k]);
+            a = (psm == GU_PSM_DXT3 ? i * 17 :
+                 psm == GU_PSM_DXT5 ? dxt5_alphas[b][i % 8] : c >> 24);
+
+            texels[(i / 4) * DXT_W + b*4 + i % 4] = (c & 0xFFFFFF) | a << 24;
+        }
+    }
+
+    return p - blocks;
+}
+
+
+void dxt_draw(g2dTexture *tex)
+{
+    g2dClear(G2D_RGBA(64, 128, 192, 255));
+    g2dBeginRects(tex);
+    g2dSetTexLinear(false);
+    g2dSetScaleWH(DXT_SCALE * DXT_W, DXT_SCALE * DXT_H);
+    g2dAdd();
+    g2dEnd();
+    g2dFlip(G2D_VSYNC);
+}
+
+
+void test_dxt()
+{
+    static const char *names[3] = {"DXT1", "DXT3", "DXT5"};
+    static const int psms[3] = {GU_PSM_DXT1, GU_PSM_DXT3, GU_PSM_DXT5};
+    unsigned char blocks[2*16];
+    g2dColor texels[DXT_W*DXT_H];
+    g2dTexture *tex, *ref;
+    char name[64];
+    size_t size;
+    int f, y;
+
+    for (f=0; f<3; f++)
+    {
+        sprintf(name, "dds, %s pixels match", names[f]);
+        size = dxt_blocks(psms[f], blocks, texels);
+
+        if (!dds_write(DDS_PATH, names[f], DXT_W, DXT_H, blocks, size) ||
+            (tex = g2dTexLoad(DDS_PATH, G2D_VOID)) == NULL)
+        {
+            check(name, false);
+            continue;
+        }
+
+        // Drawn the same way as the texels, decoded by hand.
+        ref = g2dTexCreate(DXT_W, DXT_H, G2D_VOID);
+        for (y=0; y<DXT_H; y++)
+            memcpy(ref->data + y*ref->tw, texels + y*DXT_W, 4*DXT_W);
+
+        dxt_draw(ref);
+        frame_ref();
+        dxt_draw(tex);
+        check(name, tex->psm == psms[f] && frame_same());
+
+        g2dTexFree(&ref);
+        g2dTexFree(&tex);
+    }
+
+    remove(DDS_PATH);
+}
+
+
+// Color of the last sceGuColor() call of the last list, 0 if none.
+unsigned int last_color()
+{
+    const GuRecList *l = guRecLastList();
+    unsigned int color = 0;
+    int i;
+
+    for (i=0; i<l->command_count; i++)
+    {
+        if (l->commands[i].op == GUREC_COLOR)
+            color = l->commands[i].args[0];
+    }
+
+    return color;
+}
+
+
+void test_gu_color()
+{
+    int i;
+
+    // Tinted batches, each one followed by pspgu code expecting white.
+    g2dClear(BLACK);
+
+    for (i=0; i<2; i++)
+    {
+        g2dBeginRects(NULL);
+        g2dSetColor(RED);
+        g2dSetScaleWH(10, 10);
+        g2dAdd();
+        g2dEnd();
+    }
+
+    g2dFlip(G2D_VSYNC);
+
+    check("gu color, white after g2dEnd", last_color() == WHITE);
+}
+
+
+// Batches of all kinds, compatible ones in a row.
+void deferred_scene(g2dTexture *tex)
+{
+    int b, i;
+
+    seed = 1;
+    g2dClear(BLACK);
+
+    for (b=0; b<SCENE_BATCH_NBR; b++)
+    {
+        switch (b % 6)
+        {
+            case 0:
+            case 1:
+                g2dBeginRects(NULL);
+                g2dSetColor(b % 12 < 6 ? RED : BLUE);
+                break;
+
+            case 2:
+            case 3:
+                g2dBeginRects(tex);
+                break;
+
+            case 4:
+                g2dBeginLines(G2D_VOID);
+                break;
+
+            default:
+                g2dBeginQuads(tex);
+                break;
+        }
+
+        for (i=0; i<SCENE_OBJ_NBR; i++)
+        {
+            g2dSetCoordXY(rnd(G2D_SCR_W), rnd(G2D_SCR_H));
+
+            if (b % 6 == 3)
+                g2dSetRotation(rnd(360));
+            if (b % 6 == 4)
+                g2dSetColor(0xFF000000 | rnd(0x1000000));
+
+            g2dSetScaleWH(4 + rnd(40), 4 + rnd(40));
+            g2dAdd();
+        }
+
+        g2dEnd();
+    }
+
+    g2dFlip(G2D_VSYNC);
+}
+
+
+void test_deferred()
+{
+    g2dTexture *tex = random_tex(32, 32);
+    g2dFrameStats stats;
+    unsigned int draw_calls;
+
+    deferred_scene(tex);
+    frame_ref();
+    g2dGetFrameStats(&stats);
+    draw_calls = stats.draw_calls;
+
+    g2dSetDeferred(true);
+    deferred_scene(tex);
+    g2dSetDeferred(false);
+    g2dGetFrameStats(&stats);
+
+    check("deferred, batches merged", stats.draw_calls < draw_calls);
+    check("deferred, pixels match immediate", frame_same());
+
+    g2dTexFree(&tex);
+}
+
+
+// Textured, colored & rotated rects, then lines, all moved by (dx, dy).
+void batch_scene(g2dTexture *tex, int dx, int dy)
+{
+    int i;
+
+    seed = 2;
+
+    g2dBeginRects(tex);
+    for (i=0; i<SCENE_OBJ_NBR; i++)
+    {
+        g2dSetCoordXY(dx + rnd(G2D_SCR_W), dy + rnd(G2D_SCR_H));
+        g2dSetScaleWH(8 + rnd(60), 8 + rnd(60));
+        if (i % 3 == 0)
+            g2dSetRotation(rnd(360));
+        g2dAdd();
+    }
+    g2dEnd();
+
+    g2dBeginRects(NULL);
+    g2dSetColor(GREEN);
+    for (i=0; i<SCENE_OBJ_NBR; i++)
+    {
+        g2dSetCoordXY(dx + rnd(G2D_SCR_W) + 0.5f, dy + rnd(G2D_SCR_H));
+        g2dSetScaleWH(4 + rnd(20), 4 + rnd(20));
+        g2dAdd();
+    }
+    g2dEnd();
+
+    g2dBeginLines(G2D_STRIP);
+    for (i=0; i<SCENE_OBJ_NBR; i++)
+    {
+        g2dSetColor(0xFF000000 | rnd(0x1000000));
+        g2dSetCoordXY(dx + rnd(G2D_SCR_W), dy + rnd(G2D_SCR_H));
+        g2dAdd();
+    }
+    g2dEnd();
+}
+
+
+void test_batch()
+{
+    g2dTexture *tex = random_tex(32, 32);
+    g2dBatch *b;
+
+    // Recorded out of a frame, at loading time.
+    g2dBatchBegin();
+    batch_scene(tex, 0, 0);
+    b = g2dBatchEnd();
+
+    g2dClear(BLACK);
+    batch_scene(tex, 0, 0);
+    g2dFlip(G2D_VSYNC);
+    frame_ref();
+
+    g2dClear(BLACK);
+    g2dDrawBatch(b);
+    g2dFlip(G2D_VSYNC);
+    check("batch, pixels match immediate", frame_same());
+
+    g2dClear(BLACK);
+    batch_scene(tex, 37, -21);
+    g2dFlip(G2D_VSYNC);
+    frame_ref();
+
+    // Rotated corners are moved after being rounded.
+    g2dClear(BLACK);
+    g2dDrawBatchXY(b, 37, -21);
+    g2dFlip(G2D_VSYNC);
+    check("batch, translated pixels match", frame_close());
+
+    g2dBatchFree(&b);
+    g2dTexFree(&tex);
+}
+
+
+// Object arrays, used by both paths of the bulk test.
+static float bulk_x[BULK_NBR], bulk_y[BULK_NBR];
+static float bulk_w[BULK_NBR], bulk_h[BULK_NBR];
+static float bulk_rot[BULK_NBR];
+static g2dColor bulk_color[BULK_NBR];
+static int bulk_cx[BULK_NBR], bulk_cy[BULK_NBR];
+static int bulk_cw[BULK_NBR], bulk_ch[BULK_NBR];
+
+
+void bulk_scene(g2dTexture *tex, bool bulk)
+{
+    g2dBulk rects = {bulk_x, bulk_y, NULL, bulk_w, bulk_h, bulk_color,
+                     NULL, NULL, NULL, NULL, NULL};
+    g2dBulk crops = {bulk_x, bulk_y, NULL, bulk_w, bulk_h, NULL,
+                     bulk_cx, bulk_cy, bulk_cw, bulk_ch, bulk_rot};
+    int i;
+
+    g2dBeginRects(NULL);
+    g2dSetCoordMode(G2D_CENTER);
+    if (bulk)
+        g2dAddRects(&rects, BULK_NBR);
+    else
+    {
+        for (i=0; i<BULK_NBR; i++)
+        {
+            g2dSetCoordXY(bulk_x[i], bulk_y[i]);
+            g2dSetScaleWH(bulk_w[i], bulk_h[i]);
+            g2dSetColor(bulk_color[i]);
+            g2dAdd();
+        }
+    }
+    g2dEnd();
+
+    // Cropped and rotated, after an object added the plain way.
+    g2dBeginRects(tex);
+    g2dSetAlpha(200);
+    g2dAdd();
+    if (bulk)
+        g2dAddRects(&crops, BULK_NBR);
+    else
+    {
+        for (i=0; i<BULK_NBR; i++)
+        {
+            g2dSetCoordXY(bulk_x[i], bulk_y[i]);
+            g2dSetScaleWH(bulk_w[i], bulk_h[i]);
+            g2dSetCropXY(bulk_cx[i], bulk_cy[i]);
+            g2dSetCropWH(bulk_cw[i], bulk_ch[i]);
+            g2dSetRotationRad(bulk_rot[i]);
+            g2dAdd();
+        }
+    }
+    g2dEnd();
+}
+
+
+void test_bulk()
+{
+    g2dTexture *tex = random_tex(128, 64);
+    int i;
+
+    seed = 3;
+
+    for (i=0; i<BULK_NBR; i++)
+    {
+        bulk_x[i] = rnd(G2D_SCR_W);
+        bulk_y[i] = rnd(G2D_SCR_H);
+        bulk_w[i] = 2 + rnd(40) - (i % 7 == 0 ? 60 : 0); // Some mirrored.
+        bulk_h[i] = 2 + rnd(40);
+        bulk_rot[i] = rnd(628) / 100.f;
+        bulk_color[i] = 0x80000000 | rnd(0x1000000);
+        bulk_cx[i] = rnd(20);
+        bulk_cy[i] = rnd(20);
+        bulk_cw[i] = 10 + rnd(100);
+        bulk_ch[i] = 10 + rnd(40);
+    }
+
+    g2dClear(BLACK);
+    bulk_scene(tex, false);
+    g2dFlip(G2D_VSYNC);
+    frame_ref();
+
+    g2dClear(BLACK);
+    bulk_scene(tex, true);
+    g2dFlip(G2D_VSYNC);
+    check("bulk, pixels match g2dAdd()", frame_same());
+
+    g2dTexFree(&tex);
+}
+
+
+// Grid vertices, used by both paths of the mesh test.
+static float mesh_x[MESH_ROWS+1][MESH_COLS+1];
+static float mesh_y[MESH_ROWS+1][MESH_COLS+1];
+static g2dColor mesh_color[MESH_ROWS+1][MESH_COLS+1];
+
+
+void mesh_vertex(int row, int col, int dx, int dy)
+{
+    g2dSetCoordXY(mesh_x[row][col] + dx, mesh_y[row][col] + dy);
+    g2dSetColor(mesh_color[row][col]);
+    g2dAdd();
+}
+
+
+void mesh_scene(g2dTexture *tex, bool mesh, bool integer)
+{
+    const int dr[4] = {0, 0, 1, 1}, dc[4] = {0, 1, 1, 0};
+    int r, c, k, d;
+
+    // Textured, then colored somewhere else.
+    for (d=0; d<2; d++, tex=NULL)
+    {
+        if (mesh)
+        {
+            g2dBeginMesh(tex, MESH_COLS, MESH_ROWS);
+            g2dSetCoordInteger(integer);
+            for (r=0; r<=MESH_ROWS; r++)
+            {
+                for (c=0; c<=MESH_COLS; c++)
+                    mesh_vertex(r, c, 200*d, 100*d);
+            }
+            g2dEnd();
+            continue;
+        }
+
+        g2dBeginQuads(tex);
+        g2dSetCoordInteger(integer);
+        for (r=0; r<MESH_ROWS; r++)
+        {
+            for (c=0; c<MESH_COLS; c++)
+            {
+                g2dSetCropXY(c * MESH_CELL, r * MESH_CELL);
+                g2dSetCropWH(MESH_CELL, MESH_CELL);
+                for (k=0; k<4; k++)
+                    mesh_vertex(r + dr[k], c + dc[k], 200*d, 100*d);
+            }
+        }
+        g2dEnd();
+    }
+}
+
+
+void test_mesh()
+{
+    g2dTexture *tex = random_tex(MESH_COLS*MESH_CELL, MESH_ROWS*MESH_CELL);
+    int r, c, integer;
+
+    seed = 4;
+
+    for (r=0; r<=MESH_ROWS; r++)
+    {
+        for (c=0; c<=MESH_COLS; c++)
+        {
+            mesh_x[r][c] = 20 + c*25 + rnd(100) / 10.f;
+            mesh_y[r][c] = 20 + r*30 + rnd(120) / 10.f;
+            mesh_color[r][c] = 0xFF000000 | rnd(0x1000000);
+        }
+    }
+
+    for (integer=0; integer<2; integer++)
+    {
+        g2dClear(BLACK);
+        mesh_scene(tex, false, integer);
+        g2dFlip(G2D_VSYNC);
+        frame_ref();
+
+        g2dClear(BLACK);
+        mesh_scene(tex, true, integer);
+        g2dFlip(G2D_VSYNC);
+        check(integer ? "mesh, integer pixels match quads"
+                      : "mesh, pixels match quads", frame_same());
+    }
+
+    g2dTexFree(&tex);
+}
+
+
+// Coordinates on and around the screen.
+float cull_coord(int size)
+{
+    return rnd(size + 2*CULL_MARGIN) - CULL_MARGIN + rnd(4) / 4.f;
+}
+
+
+void cull_scene(g2dTexture *tex)
+{
+    int i, r;
+
+    seed = 5;
+
+    g2dBeginRects(NULL);
+    for (i=0; i<CULL_OBJ_NBR; i++)
+    {
+        g2dSetCoordMode(i % 2 ? G2D_CENTER : G2D_UP_LEFT);
+        g2dSetCoordXY(cull_coord(G2D_SCR_W), cull_coord(G2D_SCR_H));
+        g2dSetScaleWH(4 + rnd(120), 4 + rnd(120));
+        g2dSetRotation(i % 3 ? rnd(360) : 0);
+        g2dSetColor(0xFF000000 | rnd(0x1000000));
+        g2dAdd();
+    }
+    g2dEnd();
+
+    // Wide sprites, sliced, then clipped when none is rotated or mirrored.
+    for (r=0; r<2; r++)
+    {
+        g2dBeginRects(tex);
+        for (i=0; i<CULL_OBJ_NBR/4; i++)
+        {
+            g2dSetCoordMode(i % 2 ? G2D_CENTER : G2D_UP_LEFT);
+            g2dSetCoordXY(cull_coord(G2D_SCR_W), cull_coord(G2D_SCR_H));
+            g2dSetScaleWH(rnd(1000) - (r ? 200 : -8), 8 + rnd(40));
+            g2dSetCropXY(rnd(64), 0);
+            g2dSetCropWH(64 + rnd(448), 64);
+            if (r)
+                g2dSetRotation(rnd(360));
+            g2dAdd();
+        }
+        g2dEnd();
+    }
+
+    // Moved by a matrix.
+    g2dPush();
+    g2dMatrixTranslate(G2D_SCR_W/2, G2D_SCR_H/2);
+    g2dMatrixRotate(30);
+    g2dMatrixScale(1.5f, 0.75f);
+    g2dBeginQuads(NULL);
+    for (i=0; i<CULL_OBJ_NBR; i++)
+    {
+        g2dSetColor(0xFF000000 | rnd(0x1000000));
+        g2dSetCoordXY(cull_coord(G2D_SCR_W) - G2D_SCR_W/2,
+                      cull_coord(G2D_SCR_H) - G2D_SCR_H/2);
+        g2dAdd();
+        g2dSetCoordXYRelative(10 + rnd(30), 0);
+        g2dAdd();
+        g2dSetCoordXYRelative(rnd(10), 10 + rnd(30));
+        g2dAdd();
+        g2dSetCoordXYRelative(-20 - rnd(30), 0);
+        g2dAdd();
+    }
+    g2dEnd();
+    g2dPop();
+
+    g2dBeginLines(G2D_VOID);
+    for (i=0; i<CULL_OBJ_NBR; i++)
+    {
+        g2dSetColor(0xFF000000 | rnd(0x1000000));
+        g2dSetCoordXY(cull_coord(G2D_SCR_W), cull_coord(G2D_SCR_H));
+        g2dAdd();
+        g2dSetCoordXYRelative(rnd(40) - 20, rnd(40) - 20);
+        g2dAdd();
+    }
+    g2dEnd();
+
+    g2dBeginPoints();
+    for (i=0; i<CULL_OBJ_NBR; i++)
+    {
+        g2dSetColor(0xFF000000 | rnd(0x1000000));
+        g2dSetCoordXY(cull_coord(G2D_SCR_W), cull_coord(G2D_SCR_H));
+        g2dAdd();
+    }
+    g2dEnd();
+}
+
+
+// Culling and clipping only skip what the scissor would drop anyway.
+void cull_check(const char *name, g2dTexture *tex, bool cull, bool clip)
+{
+    int i;
+
+    for (i=0; i<4; i++)
+    {
+        _g2dSetSliceWidth(i % 2 ? 32 : 0);
+
+        g2dClear(BLACK);
+        if (i >= 2)
+            g2dSetScissor(90, 40, 300, 190);
+        _g2dSetCulling(false);
+        _g2dSetClipping(false);
+        cull_scene(tex);
+        g2dFlip(G2D_VSYNC);
+        frame_ref();
+
+        g2dClear(BLACK);
+        if (i >= 2)
+            g2dSetScissor(90, 40, 300, 190);
+        _g2dSetCulling(cull);
+        _g2dSetClipping(clip);
+        cull_scene(tex);
+        g2dFlip(G2D_VSYNC);
+
+        // Clipped sprites start from a moved position, filtered texels
+        // can round differently.
+        if (clip ? !frame_close() : !frame_same())
+            break;
+    }
+
+    g2dResetScissor();
+    _g2dSetSliceWidth(0);
+    _g2dSetCulling(true);
+    _g2dSetClipping(true);
+
+    check(name, i == 4);
+}
+
+
+void test_cull()
+{
+    g2dTexture *tex = random_tex(512, 64);
+
+    cull_check("culling, pixels match", tex, true, false);
+    cull_check("clipping, pixels match", tex, false, true);
+    cull_check("culling and clipping, pixels match", tex, true, true);
+
+    g2dTexFree(&tex);
+}
+
+
+int main()
+{
+    srand(1);
+
+    test_sincos();
+    test_gu_color();
+    test_deferred();
+    test_batch();
+    test_bulk();
+    test_mesh();
+    test_cull();
+    test_vram_pool();
+    test_palette_png();
+    test_dds_checks();
+    test_dxt();
+
+    g2dTerm();
+
+    printf("%d failed\n", failures);
+
+    return failures;
+}
+
+// EOF
@@ -0,0 +1,27 @@
+/*
+ * gLib2D - A simple, fast, light-weight 2D graphics library.
+ *
+ * Host stand-in for libpspvram.
+ * VRAM is simulated by a 2 MiB block of main memory, relative pointers
+ * are offsets inside this block.
+ */
+
+#ifndef G2D_HOST_VRAM_H
+#define G2D_HOST_VRAM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HOST_VRAM_SIZE (2*1024*1024)
+
+void* vrelptr(void *ptr);
+void* vabsptr(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
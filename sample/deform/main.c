@@ -1,6 +1,7 @@
-// Quads and lines use.
+// Quads, lines and mesh use.
 
 #include <pspkernel.h>
+#include <math.h>
 #include "../../glib2d.h"
 #include "../callbacks.h"
 
@@ -11,6 +12,7 @@ int main()
 {
   callbacks_setup();
   int rot = 0;
+  int x, y;
 
   while (1)
   {
@@ -95,6 +97,23 @@ int main()
 
     g2dEnd();
 
+    // And a waving mesh.
+
+    g2dBeginMesh(NULL,8,4); // Can be also textured
+
+    for (y=0; y<=4; y++)
+    {
+      for (x=0; x<=8; x++)
+      {
+        g2dSetColor(G2D_RGBA(32*x,64*y,255,255));
+        g2dSetCoordXY(G2D_SCR_W/2-80+20*x,
+                      G2D_SCR_H/2-40+20*y+8.f*sinf((rot+40*x)*M_PI/180.f));
+        g2dAdd();
+      }
+    }
+
+    g2dEnd();
+
     g2dFlip(G2D_VSYNC);
   }
 